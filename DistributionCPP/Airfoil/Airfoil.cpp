@@ -1,7 +1,9 @@
 #include "Airfoil.h"
 #include <cmath>
+#include <stdio.h>
 #include <stdlib.h>
-#include <gsl/gsl_histogram.h>
+#include <assert.h>
+#include <algorithm>
 #include <VectorOperations/VectorOperations.h>
 
 using namespace std;
@@ -37,19 +39,12 @@ Airfoil::Airfoil(const std::string& inDir, std::vector<double>& X, std::vector<d
     normal_(i,0) = -(tangent_(i-1,1)+tangent_(i,1)+tangent_(i+1,1))/3.0;
     normal_(i,1) = (tangent_(i-1,0)+tangent_(i,0)+tangent_(i+1,0))/3.0;
   }
-  // Set quadtree search object bounds
-  double minX, minY, maxX, maxY;
-  minX = panelX_.minCoeff() - 0.1; maxX = panelX_.maxCoeff() + 0.1;
-  minY = panelY_.minCoeff() - 0.1; maxY = panelY_.maxCoeff() + 0.1;
-  double SW[2] = {minX, minY};
-  double SE[2] = {maxX, minY};
-  double NW[2] = {minX, maxY};
-  double NE[2] = {maxX, maxY};
-  panelSearcher_.setBounds(&SW[0],&SE[0],&NW[0],&NE[0]);
-  // Create quadtree search object
-  panelSearcher_.calcQuadTree(panelX_.data(),panelY_.data(),panelX_.rows());
+  // Create panel search object (hierarchy over the panel segments)
+  panelSearcher_.build(X,Y);
   // Calculate s-coordinates of panel points
   this->calcSCoords();
+  // Collection efficiency bins
+  this->setFilmBinWidth(0.0025);
   // Output to file
   const std::string s_airXY   = inDir_ + "/AirfoilXY.out";
   const std::string s_airTXTY = inDir_ + "/AirfoilTxTy.out";
@@ -98,34 +93,64 @@ Airfoil::Airfoil(std::vector<double>& X, std::vector<double>& Y) {
     normal_(i,0) = -(tangent_(i-1,1)+tangent_(i,1)+tangent_(i+1,1))/3.0;
     normal_(i,1) = (tangent_(i-1,0)+tangent_(i,0)+tangent_(i+1,0))/3.0;
   }
-  // Set quadtree search object bounds
-  double minX, minY, maxX, maxY;
-  minX = panelX_.minCoeff() - 0.1; maxX = panelX_.maxCoeff() + 0.1;
-  minY = panelY_.minCoeff() - 0.1; maxY = panelY_.maxCoeff() + 0.1;
-  double SW[2] = {minX, minY};
-  double SE[2] = {maxX, minY};
-  double NW[2] = {minX, maxY};
-  double NE[2] = {maxX, maxY};
-  panelSearcher_.setBounds(&SW[0],&SE[0],&NW[0],&NE[0]);
-  // Create quadtree search object
-  panelSearcher_.calcQuadTree(panelX_.data(),panelY_.data(),panelX_.rows());
+  // Create panel search object (hierarchy over the panel segments)
+  panelSearcher_.build(X,Y);
   // Calculate s-coordinates of panel points
   this->calcSCoords();
+  // Collection efficiency bins
+  this->setFilmBinWidth(0.0025);
 }
 
 Airfoil::~Airfoil() {
   
 }
 
+void Airfoil::findClosestPoint(double xq, double yq, int& panel, double& t, double& xnn, double& ynn) {
+  // Function to return the point (xnn,ynn) on the airfoil surface closest
+  // to the query, the panel it lies on and its parameter t in [0,1] along
+  // the panel
+
+  double dist2;
+  panelSearcher_.closestPoint(xq,yq,panel,t,xnn,ynn,dist2);
+
+}
+
+void Airfoil::trackClosestPoint(double xq, double yq, int& panel, double& t, double& xnn, double& ynn) {
+  // Function to update the closest point on the airfoil surface for a
+  // query which has moved since it was last on 'panel' (-1 if unknown):
+  // walks along neighboring panels, then confirms the result with a tree
+  // search bounded by the walk's distance (exact, and cheap when the
+  // previous panel is close)
+
+  double dist2;
+  panelSearcher_.walkClosestPoint(xq,yq,panel,t,xnn,ynn,dist2);
+
+}
+
+void Airfoil::getPanelNormal(int panel, double& Nx, double& Ny) {
+  Nx = normal_(panel,0);
+  Ny = normal_(panel,1);
+}
+
+void Airfoil::getPanelTangent(int panel, double& Tx, double& Ty) {
+  Tx = tangent_(panel,0);
+  Ty = tangent_(panel,1);
+}
+
+double Airfoil::calcSCoord(int panel, double t) {
+  // Function to return the s-coord of the point at parameter t along a
+  // panel (s-coords are measured at panel centers)
+
+  return panelS_(panel) + (t-0.5)*DS_(panel);
+}
+
 void Airfoil::findPanel(std::vector<double>& XYq, std::vector<double>& XYnn, std::vector<double>& NxNy, std::vector<double>& TxTy) {
   // Function to return (x,y) coordinates and normal/tangential 
   // vectors of the point on the airfoil closest to the query
 
-  double xq = XYq[0];
-  double yq = XYq[1];
-  double xnn,ynn;
+  double xnn,ynn,t;
   int indnn;
-  panelSearcher_.knnSearch(&xq,&yq,&xnn,&ynn,&indnn);
+  this->findClosestPoint(XYq[0],XYq[1],indnn,t,xnn,ynn);
   XYnn[0] = xnn; XYnn[1] = ynn;
   NxNy[0] = normal_(indnn,0); 
   NxNy[1] = normal_(indnn,1);
@@ -137,13 +162,11 @@ void Airfoil::findPanel(std::vector<double>& XYq, std::vector<double>& XYnn, std
 void Airfoil::findPanel(std::vector<double>& XYq, std::vector<double>& XYnn, std::vector<double>& NxNy, std::vector<double>& TxTy, int& indexNN) {
   // Function to return (x,y) coordinates and normal/tangential 
   // vectors of the point on the airfoil closest to the query
-  // AS WELL AS the index of the closest panel point
+  // AS WELL AS the index of the closest panel
 
-  double xq = XYq[0];
-  double yq = XYq[1];
-  double xnn,ynn;
+  double xnn,ynn,t;
   int indnn;
-  panelSearcher_.knnSearch(&xq,&yq,&xnn,&ynn,&indnn);
+  this->findClosestPoint(XYq[0],XYq[1],indnn,t,xnn,ynn);
   XYnn[0] = xnn; XYnn[1] = ynn;
   NxNy[0] = normal_(indnn,0); 
   NxNy[1] = normal_(indnn,1);
@@ -196,69 +219,70 @@ void Airfoil::calcSCoords() {
 }
 
 double Airfoil::interpXYtoS(std::vector<double>& XYq) {
-  // Function to approximate s-coords of query pt (x,y) on airfoil surface
+  // Function to compute s-coords of query pt (x,y) on airfoil surface,
+  // from its projection onto the closest panel
   // NOTE: assumes directionality of tangent vectors!
 
-  double xq = XYq[0]; double yq = XYq[1];
-  // Find closest panel point
-  std::vector<double> XYa(2);
-  std::vector<double> NxNy(2);
-  std::vector<double> TxTy(2);
-  std::vector<double> velUnitNorm(2);
+  double xnn,ynn,t;
   int indNN;
-  this->findPanel(XYq,XYa,NxNy,TxTy,indNN);
-  // Find coordinates of query point in panel frame
-  double dx = xq - XYa[0];
-  double dy = yq - XYa[1];
-  // Project displacement vector onto tangent vector
-  double tangDisplacement = dx*TxTy[0] + dy*TxTy[1];
-  double sCoord;
-  if (tangDisplacement > 0) {
-    sCoord = panelS_(indNN) + sqrt(pow(dx,2) + pow(dy,2));
-  }
-  else {
-    sCoord = panelS_(indNN) - sqrt(pow(dx,2) + pow(dy,2));
-  }
-  // Estimate s-coordinate of query point by adding tangent displacement
-  // sCoord = panelS_(indNN) + tangDisplacement;
+  this->findClosestPoint(XYq[0],XYq[1],indNN,t,xnn,ynn);
+
+  return this->calcSCoord(indNN,t);
+
+}
+
+void Airfoil::setFilmBinWidth(double dS) {
+  // Function to set the width of the s-coord bins collecting impinged mass
+  // (bins cover the whole surface; any mass collected so far is discarded)
+
+  assert(dS > 0);
+  int numPanels = panelS_.size();
+  double sMin = panelS_(0) - 0.5*DS_(0);
+  double sMax = panelS_(numPanels-1) + 0.5*DS_(numPanels-1);
+  filmBinWidth_ = dS;
+  filmSmin_ = sMin;
+  numFilmBins_ = (int)ceil((sMax-sMin)/dS);
+  filmMass_.assign(numFilmBins_,0.0);
 
-  return sCoord;
+}
+
+double Airfoil::getFilmBinWidth() {
 
+  return filmBinWidth_;
 }
 
 void Airfoil::appendFilm(double sCoord, double mass) {
-  FilmScoords_.push_back(sCoord);
-  FilmMass_.push_back(mass);
+  // Function to add impinged mass at s-coord sCoord to its bin
+
+  int bin = (int)floor((sCoord-filmSmin_)/filmBinWidth_);
+  bin = min(max(bin,0),numFilmBins_-1);
+  filmMass_[bin] += mass;
 
 }
 
-void Airfoil::calcCollectionEfficiency(double fluxFreeStream,double dS) {
-  // Function to calculate collection efficiency of airfoil
-
-  if (!FilmScoords_.empty()) {
-    // Create bins
-    double minS = *min_element(FilmScoords_.begin(),FilmScoords_.end());
-    double maxS = *max_element(FilmScoords_.begin(),FilmScoords_.end());
-    // double dS = (maxS-minS)/(numBins-1);
-    int numBins = (maxS-minS)/dS + 1;
-    gsl_histogram *h = gsl_histogram_alloc(numBins);
-    // Histogram count of mass in each bin
-    gsl_histogram_set_ranges_uniform(h,minS,maxS);
-    for (int i=0; i<FilmMass_.size(); i++) {
-      gsl_histogram_accumulate(h,FilmScoords_[i],FilmMass_[i]);
-    }
-    BetaBins_.resize(numBins);
-    Beta_.resize(numBins);
-    double upper,lower,cent,mass,fluxLocal;
-    for (int i=0; i<numBins; i++) {
-      gsl_histogram_get_range(h,i,&lower,&upper);
-      cent = 0.5*(upper+lower);
-      BetaBins_[i] = cent-stagPt_;
-      mass = gsl_histogram_get(h,i);
-      fluxLocal = mass/dS;
-      Beta_[i] = fluxLocal/fluxFreeStream;
-    }
+void Airfoil::calcCollectionEfficiency(double fluxFreeStream) {
+  // Function to calculate collection efficiency of airfoil from the mass
+  // collected so far. Beta is reported over the range of bins which
+  // collected any mass
 
+  const std::vector<double>& mass = filmMass_;
+  int first = 0;
+  int last = numFilmBins_-1;
+  while ((first <= last) && (mass[first] == 0)) {
+    first++;
+  }
+  while ((last >= first) && (mass[last] == 0)) {
+    last--;
+  }
+  int numBins = last-first+1;
+  BetaBins_.resize(numBins);
+  Beta_.resize(numBins);
+  double cent,fluxLocal;
+  for (int i=0; i<numBins; i++) {
+    cent = filmSmin_ + (first+i+0.5)*filmBinWidth_;
+    BetaBins_[i] = cent-stagPt_;
+    fluxLocal = mass[first+i]/filmBinWidth_;
+    Beta_[i] = fluxLocal/fluxFreeStream;
   }
   
 }
@@ -267,10 +291,10 @@ void Airfoil::calcStagnationPt(PLOT3D& grid) {
   // Function to calculate the stagnation point
 
   int I = grid.getNX()-1;
-  Eigen::MatrixXf U = grid.getUCENT();
-  Eigen::MatrixXf V = grid.getVCENT();
-  Eigen::MatrixXd X = grid.getXCENT();
-  Eigen::MatrixXd Y = grid.getYCENT();
+  const Eigen::MatrixXf& U = grid.getUCENT();
+  const Eigen::MatrixXf& V = grid.getVCENT();
+  const Eigen::MatrixXd& X = grid.getXCENT();
+  const Eigen::MatrixXd& Y = grid.getYCENT();
   double u; double v;
   int i1 = floor(0.35*I);
   int i2 = floor(0.50*I);
@@ -380,10 +404,8 @@ double Airfoil::computeJaggednessCriterion(int id1, int id2, int id3, int id4) {
 void Airfoil::growIce(vector<double>& sTHERMO, vector<double>& mice, double DT, double chord, const char* strSurf) {
   // Function to update XY grid coordinates based on ice growth rate for DT time interval
 
-  vector<double> indAIRFOIL;
-  vector<double> indTHERMO;
-  double minimum;
-  int ind;
+  vector<int> indAIRFOIL;
+  vector<double> miceAIRFOIL;
   double s_min,s_max;
   
   // Match s-coordinates of airfoil to those from finely-resolved thermo calculation
@@ -399,18 +421,30 @@ void Airfoil::growIce(vector<double>& sTHERMO, vector<double>& mice, double DT,
     s_min = -0.4;
     s_max = 0.4;
   }
-  vector<double> tmp1(sTHERMO.size());
-  vector<double> tmp2(sTHERMO.size());
-  double sCoord;
+  // Both sets of s-coords are sorted, so the thermo interval containing
+  // each panel is found by walking forward through sTHERMO; the ice
+  // growth rate is interpolated linearly within it (and held constant
+  // beyond the ends of the thermo grid)
+  int NT = sTHERMO.size();
+  int j = 0;
+  double sCoord,w;
   for (int i=0; i<panelS_.size(); i++) {
     sCoord = panelS_(i) - stagPt_;
     if ( ((sCoord >= s_min) && (sCoord <= s_max)) ) {
-      for (int j=0; j<sTHERMO.size(); j++)
-	tmp1[j] = sTHERMO[j] - sCoord;
-      tmp2 = abs(tmp1);
-      minimum = min(tmp2,ind);
-      indTHERMO.push_back(ind);
+      while ((j < NT-2) && (sTHERMO[j+1] <= sCoord)) {
+        j++;
+      }
       indAIRFOIL.push_back(i);
+      if ((NT == 1) || (sCoord <= sTHERMO[0])) {
+        miceAIRFOIL.push_back(mice[0]);
+      }
+      else if (sCoord >= sTHERMO[NT-1]) {
+        miceAIRFOIL.push_back(mice[NT-1]);
+      }
+      else {
+        w = (sCoord - sTHERMO[j])/(sTHERMO[j+1] - sTHERMO[j]);
+        miceAIRFOIL.push_back((1.0-w)*mice[j] + w*mice[j+1]);
+      }
     }
   }
 
@@ -419,7 +453,7 @@ void Airfoil::growIce(vector<double>& sTHERMO, vector<double>& mice, double DT,
   double xNEW,yNEW,dH,dH_old,dH_tmp,ip,theta;
   vector<double> DH(indAIRFOIL.size());
   for (int i=0; i<indAIRFOIL.size(); i++) {
-    dH = mice[indTHERMO[i]]*DT/rhoICE;
+    dH = miceAIRFOIL[i]*DT/rhoICE;
     DH[i] = dH;
   }
   // Moving average smoothing
@@ -435,14 +469,14 @@ void Airfoil::growIce(vector<double>& sTHERMO, vector<double>& mice, double DT,
     normalX[i] = normal_(indAIRFOIL[i],0);
     normalY[i] = normal_(indAIRFOIL[i],1);
   }
-  vector<vector<double> > LAPL_NX(NL,vector<double>(NL));
-  vector<vector<double> > LAPL_NY(NL,vector<double>(NL));
-  vector<double> NX_smooth(NL);
-  vector<double> NY_smooth(NL);
-  LAPL_NX = LaplacianMatrix(NL,eps);
-  LAPL_NY = LaplacianMatrix(NL,eps);
-  NX_smooth = tridiagSolve(LAPL_NX,normalX);
-  NY_smooth = tridiagSolve(LAPL_NY,normalY);
+  // (both components with one factorization)
+  TridiagMatrix LAPL_N = LaplacianMatrix(NL,eps);
+  vector<vector<double> > N_smooth(2);
+  N_smooth[0].swap(normalX);
+  N_smooth[1].swap(normalY);
+  tridiagSolve(LAPL_N,N_smooth);
+  vector<double>& NX_smooth = N_smooth[0];
+  vector<double>& NY_smooth = N_smooth[1];
 
   // Correction for area oblation
   vector<double> DH_area(NL);
@@ -461,10 +495,8 @@ void Airfoil::growIce(vector<double>& sTHERMO, vector<double>& mice, double DT,
 
   // Implicit Laplacian smoothing
   eps = 10.0;
-  vector<vector<double> > LAPL_DH(NL,vector<double>(NL));
-  LAPL_DH = LaplacianMatrix(NL,eps);
-  vector<double> DH_smooth(NL);
-  DH_smooth = tridiagSolve(LAPL_DH,DH_area);
+  TridiagMatrix LAPL_DH = LaplacianMatrix(NL,eps);
+  vector<double> DH_smooth = tridiagSolve(LAPL_DH,DH_area);
   // Displace each grid point along its normal vector
   double NX,NY;
   for (int i=0; i<NL; i++) {
@@ -532,62 +564,59 @@ double Airfoil::getStagPt() {
 
 
 
-vector<double> Airfoil::tridiagSolve(vector<vector<double>>& A, vector<double>& r) {
+vector<double> Airfoil::tridiagSolve(TridiagMatrix& A, vector<double>& r) {
   // Tridiagonal matrix solver; solves A*x = r
 
-  int N = r.size();
-  // Get band-diagonal components of matrix A
-  vector<double> a(N);
-  vector<double> b(N);
-  vector<double> c(N);
-  a[0]   = 0; b[0]   = A[0][0];     c[0]   = 0;
-  a[N-1] = 0; b[N-1] = A[N-1][N-1]; c[N-1] = 0;
-  for (int i=1; i<N-1; i++) {
-    a[i] = A[i][i-1];
-    b[i] = A[i][i];
-    c[i] = A[i][i+1];
-  }
-  // Main algorithm
-  vector<double> x(N);
-  double bet;
+  vector<vector<double> > R(1,r);
+  this->tridiagSolve(A,R);
+
+  return R[0];
+
+} 
+
+void Airfoil::tridiagSolve(TridiagMatrix& A, vector<vector<double> >& R) {
+  // Tridiagonal matrix solver for several right-hand sides; solves
+  // A*x = r in place for each r in R, factorizing A once
+
+  int N = A.b.size();
+  vector<double>& a = A.a;
+  vector<double>& b = A.b;
+  vector<double>& c = A.c;
+  // Decomposition
+  vector<double> bet(N);
   vector<double> gam(N);
-  // Decomposition and forward substitution
-  bet = b[0];
-  x[0] = r[0]/bet;
+  bet[0] = b[0];
   for (int i=1; i<N; i++) {
-    gam[i] = c[i-1]/bet;
-    bet = b[i] - a[i]*gam[i];
-    x[i] = (r[i] - a[i]*x[i-1])/bet;
+    gam[i] = c[i-1]/bet[i-1];
+    bet[i] = b[i] - a[i]*gam[i];
   }
-  // Backsubstitution
-  for (int i=N-2; i>-1; i--) {
-    x[i] -= gam[i+1]*x[i+1];
+  for (size_t k=0; k<R.size(); k++) {
+    vector<double>& x = R[k];
+    assert((int)x.size() == N);
+    // Forward substitution
+    x[0] = x[0]/bet[0];
+    for (int i=1; i<N; i++) {
+      x[i] = (x[i] - a[i]*x[i-1])/bet[i];
+    }
+    // Backsubstitution
+    for (int i=N-2; i>-1; i--) {
+      x[i] -= gam[i+1]*x[i+1];
+    }
   }
 
-  return x;
-
-} 
+}
 
 
-vector<vector<double> > Airfoil::LaplacianMatrix(int N, double eps) {
-  // Subroutine to compute a Laplacian matrix
+TridiagMatrix Airfoil::LaplacianMatrix(int N, double eps) {
+  // Subroutine to compute a Laplacian matrix (banded storage). The first
+  // and last rows are not coupled to their neighbors
 
-  vector<vector<double> > LAPL(N,vector<double>(N));
-  // Compute Laplacian matrix
-  for (int i=0; i<N; i++) {
-    for (int j=0; j<N; j++) {
-      LAPL[i][j] = 0.0;
-    }
-  }
-  LAPL[0][0] = 1 + 2*eps;
-  LAPL[0][1] = -eps;
-  LAPL[N-1][N-1] = 1 + 2*eps;
-  LAPL[N-1][N-2] = -eps;
-  for (int i=1; i<N-1; i++) {
-    LAPL[i][i-1] = -eps;
-    LAPL[i][i]   = 1 + 2*eps;
-    LAPL[i][i+1] = -eps;
-  }
+  TridiagMatrix LAPL;
+  LAPL.a.assign(N,-eps);
+  LAPL.b.assign(N,1 + 2*eps);
+  LAPL.c.assign(N,-eps);
+  LAPL.a[0]   = 0; LAPL.c[0]   = 0;
+  LAPL.a[N-1] = 0; LAPL.c[N-1] = 0;
 
   return LAPL;
 
@@ -2,27 +2,40 @@
 #define __AIRFOIL_H__
 
 #include <eigen3/Eigen/Dense>
-#include <QuadTree/Bucket.h>
-#include <gsl/gsl_histogram.h>
+#include <Airfoil/SegmentBVH.h>
 #include <Grid/PLOT3D.h>
 
+// Tridiagonal matrix in banded storage: row i is
+// a[i]*x[i-1] + b[i]*x[i] + c[i]*x[i+1] (a[0] and c[N-1] are not used)
+struct TridiagMatrix {
+  std::vector<double> a;
+  std::vector<double> b;
+  std::vector<double> c;
+};
+
 class Airfoil {
   public:
     Airfoil(const std::string& inDir, std::vector<double>& X, std::vector<double>& Y);
     Airfoil(std::vector<double>& X, std::vector<double>& Y);
     ~Airfoil();
+    void findClosestPoint(double xq, double yq, int& panel, double& t, double& xnn, double& ynn);
+    void trackClosestPoint(double xq, double yq, int& panel, double& t, double& xnn, double& ynn);
+    void getPanelNormal(int panel, double& Nx, double& Ny);
+    void getPanelTangent(int panel, double& Tx, double& Ty);
+    double calcSCoord(int panel, double t);
     void findPanel(std::vector<double>& XYq, std::vector<double>& XYnn, std::vector<double>& NxNy, std::vector<double>& TxTy);
     void findPanel(std::vector<double>& XYq, std::vector<double>& XYnn, std::vector<double>& NxNy, std::vector<double>& TxTy, int& indexNN);
     double calcIncidenceAngle(std::vector<double>& XYq,std::vector<double>& UVq,int indNN);
     double interpXYtoS(std::vector<double>& XYq);
     void appendFilm(double sCoord, double mass);
-    void calcCollectionEfficiency(double fluxFreeStream,double dS);
+    void calcCollectionEfficiency(double fluxFreeStream);
     void calcStagnationPt(PLOT3D& grid);
     // Methods for updating grid based on thermodynamic ice calculation
     double computeJaggednessCriterion(int id1, int i2, int id3, int id4);
     void correctJagged(int id1, int id2, int id3, int id4);
-    std::vector<double> tridiagSolve(std::vector<std::vector<double>>& A, std::vector<double>& r);
-    std::vector<std::vector<double>> LaplacianMatrix(int N, double eps);
+    std::vector<double> tridiagSolve(TridiagMatrix& A, std::vector<double>& r);
+    void tridiagSolve(TridiagMatrix& A, std::vector<std::vector<double> >& R);
+    TridiagMatrix LaplacianMatrix(int N, double eps);
     std::vector<double> movingAverage(std::vector<double>& X, double smooth);
     std::vector<double> movingAverage(Eigen::VectorXd& X, double smooth);
     void growIce(std::vector<double>& sTHERMO, std::vector<double>& mice, double DT, double chord, const char* strSurf);
@@ -32,6 +45,8 @@ class Airfoil {
     std::vector<double> getX();
     std::vector<double> getY();
     void setStagPt(double sLoc);
+    void setFilmBinWidth(double dS);
+    double getFilmBinWidth();
     double getStagPt();
 
   private:
@@ -41,8 +56,12 @@ class Airfoil {
     Eigen::VectorXd DS_;
     Eigen::MatrixXd tangent_;
     Eigen::MatrixXd normal_;
-    std::vector<double> FilmScoords_;
-    std::vector<double> FilmMass_;
+    // Impinged mass binned in s (fixed bins of width filmBinWidth_ from
+    // filmSmin_ over the whole surface)
+    double filmBinWidth_;
+    double filmSmin_;
+    int numFilmBins_;
+    std::vector<double> filmMass_;
     std::vector<double> BetaBins_;
     std::vector<double> Beta_;
     double Npanels_;
@@ -51,7 +70,7 @@ class Airfoil {
     double stagPt_;
     double stagPtX_;
     double stagPtY_;
-    Bucket panelSearcher_;
+    SegmentBVH panelSearcher_;
     void calcSCoords();
     std::string inDir_;
     
@@ -0,0 +1,183 @@
+#include "SegmentBVH.h"
+#include <algorithm>
+#include <limits>
+#include <assert.h>
+
+using namespace std;
+
+SegmentBVH::SegmentBVH() {
+  closed_ = false;
+}
+
+SegmentBVH::~SegmentBVH() {
+
+}
+
+void SegmentBVH::build(const std::vector<double>& X, const std::vector<double>& Y) {
+  // Function to build the hierarchy over the segments (X[i],Y[i]) ->
+  // (X[i+1],Y[i+1]) of a polyline
+
+  X_ = X;
+  Y_ = Y;
+  nodes_.clear();
+  closed_ = (X_.size() > 2) && (X_.front() == X_.back()) && (Y_.front() == Y_.back());
+  if (this->getNumSegments() > 0) {
+    nodes_.reserve(2*(this->getNumSegments()/LEAFSIZE + 1));
+    this->buildNode(0,this->getNumSegments());
+  }
+
+}
+
+int SegmentBVH::getNumSegments() {
+
+  return std::max((int)X_.size()-1,0);
+}
+
+int SegmentBVH::buildNode(int first, int last) {
+  // Function to add the node owning segments [first,last) and its
+  // subtree; returns its index
+
+  int node = nodes_.size();
+  nodes_.push_back(Node());
+  Node& N = nodes_[node];
+  N.first = first;
+  N.last = last;
+  N.right = -1;
+  // Bounding box of the vertices of the segments
+  N.xmin = N.xmax = X_[first];
+  N.ymin = N.ymax = Y_[first];
+  for (int i=first+1; i<=last; i++) {
+    N.xmin = min(N.xmin,X_[i]); N.xmax = max(N.xmax,X_[i]);
+    N.ymin = min(N.ymin,Y_[i]); N.ymax = max(N.ymax,Y_[i]);
+  }
+  if (last-first > LEAFSIZE) {
+    int mid = (first+last)/2;
+    this->buildNode(first,mid);
+    int right = this->buildNode(mid,last);
+    nodes_[node].right = right;
+  }
+
+  return node;
+}
+
+double SegmentBVH::calcBoxDist(const Node& node, double xq, double yq) {
+  // Function to return the squared distance from a query point to the
+  // bounding box of a node (zero if the point is inside)
+
+  double dx = max(max(node.xmin-xq, xq-node.xmax), 0.0);
+  double dy = max(max(node.ymin-yq, yq-node.ymax), 0.0);
+
+  return dx*dx + dy*dy;
+}
+
+void SegmentBVH::closestPoint(double xq, double yq, int& seg, double& t, double& xnn, double& ynn, double& dist2) {
+  // Function to find the point of the polyline closest to (xq,yq): the
+  // segment, the parameter t in [0,1] along it, the point and the squared
+  // distance
+
+  seg = -1;
+  t = 0;
+  dist2 = numeric_limits<double>::infinity();
+  this->searchTree(xq,yq,seg,t,dist2);
+  if (seg >= 0) {
+    xnn = X_[seg] + t*(X_[seg+1]-X_[seg]);
+    ynn = Y_[seg] + t*(Y_[seg+1]-Y_[seg]);
+  }
+
+}
+
+void SegmentBVH::walkClosestPoint(double xq, double yq, int& seg, double& t, double& xnn, double& ynn, double& dist2) {
+  // Function to find the closest point starting from a previous answer
+  // 'seg' (-1 if none): step to whichever neighboring segment is closer to
+  // the query until neither is (wrapping around a closed polyline), for
+  // at most MAXWALK steps. The walk can stop at a local minimum (a stale
+  // guess, or a non-convex polyline), so its distance is then used to
+  // bound a tree search; when the guess is good the bound prunes nearly
+  // every node, and the answer is always exact
+
+  int numSeg = this->getNumSegments();
+  if ((seg < 0) || (seg >= numSeg)) {
+    this->closestPoint(xq,yq,seg,t,xnn,ynn,dist2);
+    return;
+  }
+  dist2 = this->calcSegmentDist(seg,xq,yq,t);
+  for (int step=0; step<MAXWALK; step++) {
+    int prev = seg-1;
+    int next = seg+1;
+    if (closed_) {
+      prev = (prev+numSeg) % numSeg;
+      next = next % numSeg;
+    }
+    int best = seg;
+    double tBest = t;
+    double dBest = dist2;
+    double tN, dN;
+    if (prev >= 0) {
+      dN = this->calcSegmentDist(prev,xq,yq,tN);
+      if (dN < dBest) {
+        best = prev; tBest = tN; dBest = dN;
+      }
+    }
+    if (next < numSeg) {
+      dN = this->calcSegmentDist(next,xq,yq,tN);
+      if (dN < dBest) {
+        best = next; tBest = tN; dBest = dN;
+      }
+    }
+    if (best == seg) {
+      break;
+    }
+    seg = best; t = tBest; dist2 = dBest;
+  }
+  // Only segments strictly closer than the walk's answer replace it
+  this->searchTree(xq,yq,seg,t,dist2);
+  xnn = X_[seg] + t*(X_[seg+1]-X_[seg]);
+  ynn = Y_[seg] + t*(Y_[seg+1]-Y_[seg]);
+
+}
+
+void SegmentBVH::searchTree(double xq, double yq, int& seg, double& t, double& dist2) {
+  // Function to improve on a candidate closest segment (seg,t,dist2):
+  // depth-first search, nearer child first, skipping nodes farther than
+  // the best segment found so far; no memory is allocated
+
+  if (nodes_.empty()) {
+    return;
+  }
+  int stack[MAXDEPTH];
+  int numStack = 0;
+  stack[numStack++] = 0;
+  while (numStack > 0) {
+    const Node& node = nodes_[stack[--numStack]];
+    if (this->calcBoxDist(node,xq,yq) >= dist2) {
+      continue;
+    }
+    if (node.right < 0) {
+      for (int i=node.first; i<node.last; i++) {
+        double ti;
+        double d = this->calcSegmentDist(i,xq,yq,ti);
+        if (d < dist2) {
+          dist2 = d;
+          seg = i;
+          t = ti;
+        }
+      }
+    }
+    else {
+      int left = &node - &nodes_[0] + 1;
+      int right = node.right;
+      double dLeft = this->calcBoxDist(nodes_[left],xq,yq);
+      double dRight = this->calcBoxDist(nodes_[right],xq,yq);
+      assert(numStack + 2 <= MAXDEPTH);
+      if (dLeft <= dRight) {
+        stack[numStack++] = right;
+        stack[numStack++] = left;
+      }
+      else {
+        stack[numStack++] = left;
+        stack[numStack++] = right;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,58 @@
+#ifndef __SEGMENTBVH_H__
+#define __SEGMENTBVH_H__
+
+#include <vector>
+
+// Bounding volume hierarchy over the segments of a polyline, for closest
+// point queries. Nodes own contiguous ranges of segments (consecutive
+// panels are close together), are split at the middle of their range and
+// are stored depth-first in one array: the left child of a node follows
+// it, the index of the right child is stored. For a point which moves
+// slowly, walkClosestPoint starts from a previous answer, stepping along
+// neighboring segments, so the tree search that confirms it is cheap
+
+class SegmentBVH {
+ public:
+  SegmentBVH();
+  ~SegmentBVH();
+  void build(const std::vector<double>& X, const std::vector<double>& Y);
+  int getNumSegments();
+  void closestPoint(double xq, double yq, int& seg, double& t, double& xnn, double& ynn, double& dist2);
+  void walkClosestPoint(double xq, double yq, int& seg, double& t, double& xnn, double& ynn, double& dist2);
+
+ private:
+  struct Node {
+    double xmin, ymin, xmax, ymax;
+    int first;   // first segment
+    int last;    // one past the last segment
+    int right;   // index of right child, or -1 for a leaf
+  };
+  // Segments per leaf, and bound on the tree depth (sizes the search stack)
+  static const int LEAFSIZE = 4;
+  static const int MAXDEPTH = 64;
+  // Maximum number of segments crossed by one walk (before the tree search)
+  static const int MAXWALK = 16;
+  std::vector<double> X_;
+  std::vector<double> Y_;
+  std::vector<Node> nodes_;
+  bool closed_;  // last vertex coincides with the first
+  int buildNode(int first, int last);
+  double calcBoxDist(const Node& node, double xq, double yq);
+  void searchTree(double xq, double yq, int& seg, double& t, double& dist2);
+  inline double calcSegmentDist(int seg, double xq, double yq, double& t);
+};
+
+inline double SegmentBVH::calcSegmentDist(int seg, double xq, double yq, double& t) {
+  // Squared distance from a query point to a segment, and the parameter t
+  // in [0,1] of the closest point along it
+  double ax = X_[seg], ay = Y_[seg];
+  double dx = X_[seg+1]-ax, dy = Y_[seg+1]-ay;
+  double len2 = dx*dx + dy*dy;
+  t = (len2 > 0) ? ((xq-ax)*dx + (yq-ay)*dy)/len2 : 0.0;
+  t = (t < 0) ? 0.0 : ((t > 1) ? 1.0 : t);
+  double px = ax + t*dx - xq;
+  double py = ay + t*dy - yq;
+  return px*px + py*py;
+}
+
+#endif
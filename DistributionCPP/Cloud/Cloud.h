@@ -15,7 +15,7 @@ class Cloud {
   Cloud(State& state, PLOT3D& grid, double rhol, ParcelScalars& PARCEL);
   Cloud(State& state, PLOT3D& grid, double rhol);
   ~Cloud();
-  void addParticles(State& state, int indCellParent);
+  void addParticles(State& state, int indCellParent, int stepsParent = 0, int panelParent = -1);
   // Methods for SLD dynamics
   void calcDtandImpinge(Airfoil& airfoil, PLOT3D& grid);
   void transportSLD(PLOT3D& grid);
@@ -23,6 +23,9 @@ class Cloud {
   void bounceDynamics(Airfoil& airfoil);
   void splashDynamics(Airfoil& airfoil);
   void spreadDynamics(Airfoil& airfoil);
+  void coalesceParcels();
+  // Particle-major alternative to calcDtandImpinge/transportSLD
+  void advectToCompletion(Airfoil& airfoil, PLOT3D& grid, int maxiter);
   // Set/get methods
   State getState();
   void setState(State& state, PLOT3D& grid);
@@ -32,6 +35,8 @@ class Cloud {
   std::vector<int> getIMPINGETOTAL();
   std::vector<int> getINDCELL();
   std::vector<int> getIndSplash();
+  void setNumThreads(int numThreads);
+  int getNumThreads();
   // Calculate total mass method
   double calcTotalMass();
   // Clear data
@@ -55,11 +60,40 @@ class Cloud {
   std::vector<double> fb_;
   std::vector<double> vNormSq_;
   std::vector<double> vTang_;
+  // Airfoil panel closest to each particle when it was last near the
+  // surface (-1 if never), the starting point for the next panel search;
+  // and the panel and parameter along it of each impingement, shared by
+  // the bounce/spread/splash routines
+  std::vector<int> panel_;
+  std::vector<int> impingePanel_;
+  std::vector<double> impingeT_;
   double Ks0_,Kb0_;
+  // Persistent set of advected particles: indAdv_ holds the live particles,
+  // activePos_ the position of each particle in indAdv_ (-1 if not live),
+  // and deactivate_ the particles to drop from indAdv_ at the next step;
+  // steps_ counts the advection steps taken by each particle (children
+  // inherit the count of their parent)
+  enum { ACTIVE = 0, IMPINGED = 1, EXITED = 2, EXPIRED = 3, MERGED = 4 };
+  std::vector<char> status_;
+  std::vector<int> activePos_;
+  std::vector<int> steps_;
+  std::vector<int> deactivate_;
+  void reserveParticles(int capacity);
+  void initActiveSet();
+  void removeActive(int ind);
   void findInSimulation();
   void computeNewCellLocations(PLOT3D& grid);
+  void relocateParticle(int ind, PLOT3D& grid);
+  int mergeParcels(double rTol, double vTol, bool mergeAll);
+  bool checkImpinge(int ind, Airfoil& airfoil, PLOT3D& grid, double& dt);
+  bool advanceParticle(int ind, double dt, PLOT3D& grid, double muG);
   bool TrackSplashParticles_;
   bool SplashFlag_;
+  bool CoalesceFlag_;
+  int maxParcels_;
+  int numPrimary_;
+  int seed_;
+  int numThreads_;
 
 };
 
@@ -13,8 +13,14 @@ struct ParcelScalars {
   double Ymax_;
   int maxiter_;
   int refreshRate_;
+  int trajDecimation_;
   int SplashFlag_;
   int TrackSplashFlag_;
+  int seed_;
+  int threads_;
+  int advectMode_;
+  int CoalesceFlag_;
+  int maxParcels_;
 
 };
 
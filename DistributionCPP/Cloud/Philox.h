@@ -0,0 +1,86 @@
+#ifndef __PHILOX_H__
+#define __PHILOX_H__
+
+#include <stdint.h>
+
+// Counter-based random number generator (Philox4x32-10; Salmon et al.,
+// "Parallel random numbers: as easy as 1, 2, 3", SC'11). The output is a
+// pure function of (key, counter), so a stream is fully determined by the
+// run seed and the (stream, substream) ids it is created with: no state is
+// shared between threads, and the draws do not depend on the order in
+// which streams are visited
+
+class Philox {
+ public:
+  Philox(uint64_t seed, uint32_t stream, uint32_t substream);
+  double uniform();
+  double uniform(double a, double b);
+
+ private:
+  uint32_t key_[2];
+  uint32_t ctr_[4];
+  uint32_t out_[4];
+  int next_;
+  void generate();
+
+};
+
+inline Philox::Philox(uint64_t seed, uint32_t stream, uint32_t substream) {
+  // Constructor: key is the run seed, counter is (block, stream, substream)
+
+  key_[0] = (uint32_t)seed;
+  key_[1] = (uint32_t)(seed >> 32);
+  ctr_[0] = 0;
+  ctr_[1] = 0;
+  ctr_[2] = stream;
+  ctr_[3] = substream;
+  next_ = 4;
+}
+
+inline void Philox::generate() {
+  // Function to encrypt the current counter into four output words, then
+  // advance the (64 bit) block counter
+
+  const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+  const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+  uint32_t c0 = ctr_[0], c1 = ctr_[1], c2 = ctr_[2], c3 = ctr_[3];
+  uint32_t k0 = key_[0], k1 = key_[1];
+  for (int round=0; round<10; round++) {
+    uint64_t p0 = (uint64_t)M0*c0;
+    uint64_t p1 = (uint64_t)M1*c2;
+    uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += W0;
+    k1 += W1;
+  }
+  out_[0] = c0; out_[1] = c1; out_[2] = c2; out_[3] = c3;
+  if (++ctr_[0] == 0) {
+    ++ctr_[1];
+  }
+  next_ = 0;
+}
+
+inline double Philox::uniform() {
+  // Function to return a uniform deviate on [0,1) with 53 random bits
+
+  if (next_ > 2) {
+    this->generate();
+  }
+  uint64_t hi = out_[next_] >> 5;
+  uint64_t lo = out_[next_+1] >> 6;
+  next_ += 2;
+
+  return (hi*67108864.0 + lo)*(1.0/9007199254740992.0);
+}
+
+inline double Philox::uniform(double a, double b) {
+  // Function to return a uniform deviate on [a,b)
+
+  return a + (b-a)*this->uniform();
+}
+
+#endif
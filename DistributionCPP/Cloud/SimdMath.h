@@ -0,0 +1,86 @@
+#ifndef __SIMDMATH_H__
+#define __SIMDMATH_H__
+
+#include <stdint.h>
+#include <string.h>
+
+// Branch-free exp/log for use inside 'omp simd' loops. The libm functions
+// set errno and are opaque calls, which stops the loop from vectorizing;
+// these are plain arithmetic and integer bit operations, so they inline
+// and vectorize with SSE2/AVX2/AVX-512. Both agree with libm to within
+// ~1e-14 relative over the ranges used by the droplet kernels:
+// simdExp clamps its argument to [-708,709] (so it never returns 0 or
+// inf), and simdLog expects a positive, normal argument
+
+static inline double simdBitsToDouble(uint64_t b) {
+  double d;
+  memcpy(&d, &b, sizeof(double));
+  return d;
+}
+
+static inline uint64_t simdDoubleToBits(double d) {
+  uint64_t b;
+  memcpy(&b, &d, sizeof(double));
+  return b;
+}
+
+static inline double simdExp(double x) {
+  const double LOG2E = 1.4426950408889634;
+  const double LN2HI = 6.93147180369123816490e-01;
+  const double LN2LO = 1.90821492927058770002e-10;
+  const double SHIFT = 6755399441055744.0;  // 1.5*2^52: rounds to an integer in the low mantissa bits
+  x = (x < -708.0) ? -708.0 : x;
+  x = (x > 709.0) ? 709.0 : x;
+  // x = n*ln2 + r, |r| <= ln2/2
+  double kd = x*LOG2E + SHIFT;
+  double n = kd - SHIFT;
+  double r = (x - n*LN2HI) - n*LN2LO;
+  // exp(r): Taylor series to r^11 (truncation error < 1e-14)
+  double p = 1.0/39916800.0;
+  p = p*r + 1.0/3628800.0;
+  p = p*r + 1.0/362880.0;
+  p = p*r + 1.0/40320.0;
+  p = p*r + 1.0/5040.0;
+  p = p*r + 1.0/720.0;
+  p = p*r + 1.0/120.0;
+  p = p*r + 1.0/24.0;
+  p = p*r + 1.0/6.0;
+  p = p*r + 0.5;
+  p = p*r + 1.0;
+  p = p*r + 1.0;
+  // 2^n: n sits in the low bits of kd, shift it into the exponent field
+  double scale = simdBitsToDouble(simdDoubleToBits(1.0) + (simdDoubleToBits(kd) << 52));
+  return p*scale;
+}
+
+static inline double simdLog(double x) {
+  const double LN2HI = 6.93147180369123816490e-01;
+  const double LN2LO = 1.90821492927058770002e-10;
+  const double SQRT2 = 1.4142135623730951;
+  const double TWO52 = 4503599627370496.0;
+  // x = m*2^e, m in [1,2); the exponent is converted to double by placing
+  // it in the mantissa of 2^52
+  uint64_t bits = simdDoubleToBits(x);
+  double e = simdBitsToDouble(simdDoubleToBits(TWO52) | (bits >> 52)) - TWO52 - 1023.0;
+  double m = simdBitsToDouble((bits & 0x000fffffffffffffULL) | simdDoubleToBits(1.0));
+  // Center the mantissa on 1: m in [sqrt(2)/2, sqrt(2))
+  bool big = (m > SQRT2);
+  m = big ? 0.5*m : m;
+  e = big ? e + 1.0 : e;
+  // log(m) = 2*atanh(f), f = (m-1)/(m+1), |f| < 0.172: series to f^17
+  // (relative truncation error < 1e-15)
+  double f = (m - 1.0)/(m + 1.0);
+  double f2 = f*f;
+  double p = 1.0/17.0;
+  p = p*f2 + 1.0/15.0;
+  p = p*f2 + 1.0/13.0;
+  p = p*f2 + 1.0/11.0;
+  p = p*f2 + 1.0/9.0;
+  p = p*f2 + 1.0/7.0;
+  p = p*f2 + 1.0/5.0;
+  p = p*f2 + 1.0/3.0;
+  p = p*f2 + 1.0;
+  return e*LN2HI + (2.0*f*p + e*LN2LO);
+}
+
+#endif
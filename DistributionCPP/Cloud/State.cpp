@@ -1,14 +1,19 @@
 #include <eigen3/Eigen/Dense>
+#include <algorithm>
 #include "State.h"
 #include <Cloud/ParcelScalars.h>
 
 State::State() {
+  // Constructor: empty state
 
+  size_ = 0;
+  capacity_ = 0;
 }
 State::State(int size) {
   // Constructor
   
   size_ = size;
+  capacity_ = size;
   x_.resize(size);
   y_.resize(size);
   u_.resize(size);
@@ -28,6 +33,7 @@ State::State(const char* distributionType, ParcelScalars& scalars, PLOT3D& p3d)
   else {
     size_ = scalars.parcels_;
   }
+  capacity_ = size_;
   x_.resize(size_);
   y_.resize(size_);
   u_.resize(size_);
@@ -36,8 +42,6 @@ State::State(const char* distributionType, ParcelScalars& scalars, PLOT3D& p3d)
   temp_.resize(size_);
   time_.resize(size_);
   numDrop_.resize(size_);
-  double Xnn, Ynn;
-  int indnn;
   
   if (scalars.Xmin_ != scalars.Xmax_) {
     // Initialize all particles as having the same size
@@ -48,9 +52,6 @@ State::State(const char* distributionType, ParcelScalars& scalars, PLOT3D& p3d)
     for (int i=0; i<size_; i++) {
       x_(i) = distX(generator);
       y_(i) = distY(generator);
-      p3d.pointSearch(x_(i),y_(i),Xnn,Ynn,indnn);
-      u_(i) = p3d.getUCENT(indnn);
-      v_(i) = p3d.getVCENT(indnn);
       r_(i) = scalars.Rmean_;
       temp_(i) = scalars.Tmean_;
       time_(i) = 0;
@@ -62,14 +63,19 @@ State::State(const char* distributionType, ParcelScalars& scalars, PLOT3D& p3d)
     for (int i=0; i<size_; i++) {
       x_(i) = scalars.Xmax_;
       y_(i) = scalars.Ymin_ + i*dY;
-      p3d.pointSearch(x_(i),y_(i),Xnn,Ynn,indnn);
-      u_(i) = p3d.getUCENT(indnn);
-      v_(i) = p3d.getVCENT(indnn);
       r_(i) = scalars.Rmean_;
       temp_(i) = scalars.Tmean_;
       time_(i) = 0;
     }
   }
+  // Initial velocities from the gas velocity in the containing cells
+  // (located in one batched search)
+  std::vector<int> indnn(size_);
+  p3d.pointSearch(size_,x_.data(),y_.data(),NULL,NULL,indnn.data());
+  for (int i=0; i<size_; i++) {
+    u_(i) = p3d.getUCENT(indnn[i]);
+    v_(i) = p3d.getVCENT(indnn[i]);
+  }
 
   if (strcmp(distributionType,"MonoDispersed") == 0) {
     for (int i=0; i<size_; i++) {
@@ -106,15 +112,12 @@ void State::appendState(State& addition) {
   // Function to append elements to state
   
   int deltaSize = addition.size_;
-  // Resize state element vectors
-  x_.conservativeResize(size_ + deltaSize);
-  y_.conservativeResize(size_ + deltaSize);
-  u_.conservativeResize(size_ + deltaSize);
-  v_.conservativeResize(size_ + deltaSize);
-  r_.conservativeResize(size_ + deltaSize);
-  temp_.conservativeResize(size_ + deltaSize);
-  time_.conservativeResize(size_ + deltaSize);
-  numDrop_.conservativeResize(size_ + deltaSize);
+  // Grow storage geometrically, so that appending many small states
+  // (e.g. splash children, one parent at a time) copies each element
+  // O(1) times on average
+  if (size_ + deltaSize > capacity_) {
+    this->reserve(std::max(2*capacity_,size_ + deltaSize));
+  }
   // Append elements to state
   for (int i=0; i<deltaSize; i++) {
     x_(size_+i) = addition.x_(i);
@@ -129,3 +132,28 @@ void State::appendState(State& addition) {
   // Update state size
   size_ += deltaSize;
 }
+
+void State::reserve(int capacity) {
+  // Function to allocate room for at least 'capacity' elements,
+  // keeping the current ones
+
+  if (capacity <= capacity_) {
+    return;
+  }
+  x_.conservativeResize(capacity);
+  y_.conservativeResize(capacity);
+  u_.conservativeResize(capacity);
+  v_.conservativeResize(capacity);
+  r_.conservativeResize(capacity);
+  temp_.conservativeResize(capacity);
+  time_.conservativeResize(capacity);
+  numDrop_.conservativeResize(capacity);
+  capacity_ = capacity;
+}
+
+void State::resize(int size) {
+  // Function to set the number of valid elements (storage only grows)
+
+  this->reserve(size);
+  size_ = size;
+}
@@ -11,10 +11,14 @@ class State {
     State(int size);
     State();
     ~State();
-    // Append method
+    // Append/sizing methods
     void appendState(State& addition);
-    // Scalars defining particle state
+    void reserve(int capacity);
+    void resize(int size);
+    // Scalars defining particle state (vectors hold capacity_ >= size_
+    // elements; only the first size_ are valid)
     int size_;
+    int capacity_;
     Eigen::VectorXd x_; 
     Eigen::VectorXd y_;
     Eigen::VectorXd u_; 
@@ -15,16 +15,17 @@ std::vector<double> calcImpingementLimits(double Xloc,double R,double T,double r
   double Yupper = -0.1;
   // Initialize test cloud of particles at X1
   int numParticles = 100;
-  int indnn;
-  double Xnn,Ynn;
   State state(numParticles);
   double dY = (Yupper-Ylower)/(numParticles-1);
   for (int i=0; i<numParticles; i++) {
     state.x_(i) = Xloc;
     state.y_(i) = Ylower + i*dY;
-    p3d.pointSearch(state.x_(i),state.y_(i),Xnn,Ynn,indnn);
-    state.u_(i) = p3d.getUCENT(indnn);
-    state.v_(i) = p3d.getVCENT(indnn);
+  }
+  std::vector<int> indnn(numParticles);
+  p3d.pointSearch(numParticles,state.x_.data(),state.y_.data(),NULL,NULL,indnn.data());
+  for (int i=0; i<numParticles; i++) {
+    state.u_(i) = p3d.getUCENT(indnn[i]);
+    state.v_(i) = p3d.getVCENT(indnn[i]);
     state.r_(i) = R;
     state.temp_(i) = T;
     state.time_(i) = 0;
@@ -32,8 +33,8 @@ std::vector<double> calcImpingementLimits(double Xloc,double R,double T,double r
   }
   Cloud cloud(state,p3d,rhoL);
   // Intialize airfoil object
-  Eigen::MatrixXd Xgrid = p3d.getX();
-  Eigen::MatrixXd Ygrid = p3d.getY();
+  const Eigen::MatrixXd& Xgrid = p3d.getX();
+  const Eigen::MatrixXd& Ygrid = p3d.getY();
   std::vector<double> X;
   std::vector<double> Y;
   int iter = 0;
@@ -90,16 +91,17 @@ void resetCloud(Cloud& cloud,PLOT3D& p3d,double X,double Ylower,double Yupper,in
   double R = oldState.r_(0);
   double T = oldState.temp_(0);
   // Create new screen of particles
-  int indnn;
-  double Xnn,Ynn;
   State state(numParticles);
   double dY = (Yupper-Ylower)/(numParticles-1);
   for (int i=0; i<numParticles; i++) {
     state.x_(i) = X;
     state.y_(i) = Ylower + i*dY;
-    p3d.pointSearch(state.x_(i),state.y_(i),Xnn,Ynn,indnn);
-    state.u_(i) = p3d.getUCENT(indnn);
-    state.v_(i) = p3d.getVCENT(indnn);
+  }
+  std::vector<int> indnn(numParticles);
+  p3d.pointSearch(numParticles,state.x_.data(),state.y_.data(),NULL,NULL,indnn.data());
+  for (int i=0; i<numParticles; i++) {
+    state.u_(i) = p3d.getUCENT(indnn[i]);
+    state.v_(i) = p3d.getVCENT(indnn[i]);
     state.r_(i) = R;
     state.temp_(i) = T;
     state.time_(i) = 0;
@@ -0,0 +1,41 @@
+#ifndef __ALIGNEDALLOCATOR_H__
+#define __ALIGNEDALLOCATOR_H__
+
+#include <stdlib.h>
+#include <cstddef>
+#include <new>
+
+// Minimal allocator returning memory aligned to Align bytes, for standard
+// containers of cache-line aligned records (operator new only guarantees
+// alignment to 16 bytes before C++17)
+
+template <class T, std::size_t Align>
+struct AlignedAllocator {
+  typedef T value_type;
+  template <class U> struct rebind { typedef AlignedAllocator<U,Align> other; };
+
+  AlignedAllocator() {}
+  template <class U> AlignedAllocator(const AlignedAllocator<U,Align>&) {}
+
+  T* allocate(std::size_t n) {
+    void* p = NULL;
+    if (posix_memalign(&p, Align, n*sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(p);
+  }
+  void deallocate(T* p, std::size_t) {
+    free(p);
+  }
+};
+
+template <class T, class U, std::size_t Align>
+bool operator==(const AlignedAllocator<T,Align>&, const AlignedAllocator<U,Align>&) {
+  return true;
+}
+template <class T, class U, std::size_t Align>
+bool operator!=(const AlignedAllocator<T,Align>&, const AlignedAllocator<U,Align>&) {
+  return false;
+}
+
+#endif
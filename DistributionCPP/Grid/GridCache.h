@@ -0,0 +1,51 @@
+#ifndef __GRIDCACHE_H__
+#define __GRIDCACHE_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Helpers for the binary cache of derived grid data (see PLOT3D::readCache).
+// Each array is stored as its size in bytes followed by the data, so a
+// stale or truncated cache is detected while reading
+
+inline void writeCacheArray(FILE* fout, const void* data, uint64_t bytes) {
+  fwrite(&bytes, sizeof(uint64_t), 1, fout);
+  if (bytes > 0) {
+    fwrite(data, 1, bytes, fout);
+  }
+}
+
+inline bool readCacheSize(const char* buf, size_t size, size_t pos, uint64_t& bytes) {
+  // Size of the next array, without consuming it
+  if (pos + sizeof(uint64_t) > size) {
+    return false;
+  }
+  memcpy(&bytes, buf+pos, sizeof(uint64_t));
+  return (pos + sizeof(uint64_t) + bytes <= size);
+}
+
+inline bool readCacheArray(const char* buf, size_t size, size_t& pos, void* data, uint64_t bytes) {
+  uint64_t stored;
+  if (!readCacheSize(buf,size,pos,stored) || (stored != bytes)) {
+    return false;
+  }
+  pos += sizeof(uint64_t);
+  if (bytes > 0) {
+    memcpy(data, buf+pos, bytes);
+  }
+  pos += bytes;
+  return true;
+}
+
+inline uint64_t hashFNV1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+  // 64-bit FNV-1a hash of a byte range
+  for (size_t k=0; k<size; k++) {
+    hash ^= (unsigned char)data[k];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only memory mapping of a whole file (the data is not NUL-terminated).
+// A file which cannot be opened or mapped stops the run with a message
+
+class MappedFile {
+ public:
+  MappedFile(const char* filename) {
+    data_ = NULL;
+    size_ = 0;
+    fd_ = open(filename, O_RDONLY);
+    if (fd_ < 0) {
+      fprintf(stderr,"MappedFile: %s: cannot open file\n",filename);
+      exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      fprintf(stderr,"MappedFile: %s: cannot stat file\n",filename);
+      exit(EXIT_FAILURE);
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (p == MAP_FAILED) {
+        fprintf(stderr,"MappedFile: %s: cannot map file\n",filename);
+        exit(EXIT_FAILURE);
+      }
+      data_ = static_cast<const char*>(p);
+    }
+  }
+  ~MappedFile() {
+    if (data_ != NULL) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+    close(fd_);
+  }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  int fd_;
+  const char* data_;
+  size_t size_;
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+};
+
+#endif
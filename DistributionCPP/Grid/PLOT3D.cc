@@ -1,7 +1,14 @@
 #include "PLOT3D.h"
 #include <stdio.h>
-#include <assert.h>
 #include <cmath>
+#include <algorithm>
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "MappedFile.h"
+#include "GridCache.h"
+#include <Parallel/Parallel.h>
 
 using namespace std;
 using namespace Eigen;
@@ -9,39 +16,6 @@ using namespace Eigen;
 PLOT3D::PLOT3D(const char *meshfname, const char *solnfname, FluidScalars* scalars, const std::string workdir) {
   // Constructor: read in mesh/soln file data
 
-  double chord = scalars->chord_;
-  // Read in size of mesh
-  int nx, ny, n, tmp;
-  ifstream meshfile;
-  meshfile.open(meshfname);
-  meshfile >> nx; meshfile >> ny;
-  meshfile >> tmp; meshfile >> tmp; // EDIT: for use with P3D file with 4 header ints
-  nx_ = nx; ny_ = ny; n = nx*ny;
-  // Read in mesh coordinates
-  double* xy = new double[2*n];
-  for (int i=0; i<2*n; i++) {
-    meshfile >> xy[i];
-  }
-  printf("%lf\t%lf\t%lf\n",xy[2*n-3],xy[2*n-2],xy[2*n-1]);
-  x_.resize(nx_,ny_);
-  y_.resize(nx_,ny_);
-  int iter = 0;
-  for (int j=0; j<ny_; j++) {
-    for (int i=0; i<nx_; i++) {
-      x_(i,j) = xy[iter]*chord;
-      y_(i,j) = xy[iter+n]*chord;
-      iter++;
-    }
-  }
-  // Read in mach,alpha,reynolds,time
-  FILE *solnfile = fopen(solnfname, "r");
-  assert(solnfile != NULL);
-  char buff[BUFSIZ];
-  fread(buff, sizeof(int), 2, solnfile); // First 2 ints are just nx,ny
-  fread(&mach_, sizeof(float), 1, solnfile);
-  fread(&alpha_, sizeof(float), 1, solnfile);
-  fread(&reynolds_, sizeof(float), 1, solnfile);
-  fread(&time_, sizeof(float), 1, solnfile);
   // Read in scalars
   pinf_ =   scalars->pinf_;
   R_ =      scalars->R_;
@@ -49,43 +23,442 @@ PLOT3D::PLOT3D(const char *meshfname, const char *solnfname, FluidScalars* scala
   rhoinf_ = scalars->rhoinf_;
   Ubar_ =   scalars->Ubar_;
   rhol_ =   scalars->rhol_;
+  // Read in mesh coordinates and solution data
+  this->readMesh(meshfname,scalars->chord_);
+  this->readSolution(solnfname);
+  // Initialize searcher object
+  QT_.setOutDir(workdir);
+  // Derived data (cell centers, metrics, connectivity, search tree) is
+  // taken from the cache in the input directory if it was made from the
+  // same files; otherwise it is computed and the cache is rewritten
+  const std::string cacheFile = workdir + "/GridCache.bin";
+  uint64_t key = this->calcCacheKey(meshfname,solnfname,scalars->chord_);
+  if (!this->readCache(cacheFile,key)) {
+    this->computeCellCenters();
+    this->computeCellAreas();
+    this->computeGridMetrics();
+    this->computeCellRecords();
+    this->computeWakeCut();
+    this->computeNeighbors();
+    this->createQuadTree();
+    this->writeCache(cacheFile,key);
+  }
+}
+
+// Version of the grid cache layout; bump when the derived data changes
+static const uint32_t GRID_CACHE_VERSION = 1;
+
+static uint64_t hashFile(const char* filename) {
+  // Hash of a file's contents: FNV-1a of fixed-size chunks (in parallel),
+  // then of the chunk hashes
+
+  MappedFile file(filename);
+  const size_t chunk = 1 << 20;
+  long numChunks = (file.size() + chunk - 1)/chunk;
+  vector<uint64_t> hashes(numChunks);
+#pragma omp parallel for schedule(static)
+  for (long c=0; c<numChunks; c++) {
+    size_t begin = c*chunk;
+    hashes[c] = hashFNV1a(file.data()+begin,std::min(chunk,file.size()-begin));
+  }
+  uint64_t size = file.size();
+  uint64_t hash = hashFNV1a((const char*)&size,sizeof(size));
+
+  return hashFNV1a((const char*)hashes.data(),hashes.size()*sizeof(uint64_t),hash);
+}
+
+uint64_t PLOT3D::calcCacheKey(const char *meshfname, const char *solnfname, double chord) {
+  // Function to compute the key of the grid cache: hash of the mesh and
+  // solution files and of the scalars which enter the derived data
+
+  double params[3] = {chord, rhoinf_, Ubar_};
+  uint64_t hashes[2] = {hashFile(meshfname), hashFile(solnfname)};
+  uint64_t key = hashFNV1a((const char*)hashes,sizeof(hashes));
+
+  return hashFNV1a((const char*)params,sizeof(params),key);
+}
+
+bool PLOT3D::readCache(const std::string& cacheFile, uint64_t key) {
+  // Function to read the derived grid data from the cache; returns false
+  // if there is no cache, or it belongs to other input files/version
+
+  if (access(cacheFile.c_str(),R_OK) != 0) {
+    return false;
+  }
+  MappedFile file(cacheFile.c_str());
+  const char* buf = file.data();
+  size_t size = file.size();
+  size_t pos = 0;
+  char magic[8];
+  uint32_t header[4];
+  uint64_t storedKey;
+  if (!readCacheArray(buf,size,pos,magic,sizeof(magic)) || (memcmp(magic,"P3DCACHE",8) != 0) ||
+      !readCacheArray(buf,size,pos,header,sizeof(header)) ||
+      !readCacheArray(buf,size,pos,&storedKey,sizeof(storedKey))) {
+    return false;
+  }
+  if ((header[0] != GRID_CACHE_VERSION) || (header[1] != sizeof(CellRecord)) ||
+      (header[2] != (uint32_t)nx_) || (header[3] != (uint32_t)ny_) || (storedKey != key)) {
+    return false;
+  }
+  int numCells = (nx_-1)*(ny_-1);
+  Eigen::MatrixXd* cellMatD[8] = {&xCENT_, &yCENT_, &cellArea_, &Jxx_, &Jxy_, &Jyx_, &Jyy_, &Lmin_};
+  Eigen::MatrixXf* cellMatF[4] = {&rhoCENT_, &uCENT_, &vCENT_, &ECENT_};
+  for (int m=0; m<8; m++) {
+    cellMatD[m]->resize(nx_-1,ny_-1);
+    if (!readCacheArray(buf,size,pos,cellMatD[m]->data(),numCells*sizeof(double))) {
+      return false;
+    }
+  }
+  for (int m=0; m<4; m++) {
+    cellMatF[m]->resize(nx_-1,ny_-1);
+    if (!readCacheArray(buf,size,pos,cellMatF[m]->data(),numCells*sizeof(float))) {
+      return false;
+    }
+  }
+  cells_.resize(numCells);
+  neighbors_.resize(8*numCells);
+
+  return (readCacheArray(buf,size,pos,cells_.data(),numCells*sizeof(CellRecord)) &&
+          readCacheArray(buf,size,pos,&nWake_,sizeof(int)) &&
+          readCacheArray(buf,size,pos,neighbors_.data(),neighbors_.size()*sizeof(int)) &&
+          QT_.readTree(buf,size,pos));
+}
+
+void PLOT3D::writeCache(const std::string& cacheFile, uint64_t key) {
+  // Function to write the derived grid data to the cache (through a
+  // temporary file with a unique name, renamed into place when complete,
+  // so that concurrent runs in the same directory never map or rename each
+  // other's partial cache). Nothing is written if the input directory is
+  // not writable
+
+  std::vector<char> tmpName(cacheFile.begin(),cacheFile.end());
+  const char suffix[] = ".XXXXXX";
+  tmpName.insert(tmpName.end(),suffix,suffix+sizeof(suffix));
+  int fd = mkstemp(tmpName.data());
+  if (fd < 0) {
+    return;
+  }
+  const std::string tmpFile(tmpName.data());
+  // mkstemp creates the file private to the user; the cache is shared
+  fchmod(fd,0644);
+  FILE* fout = fdopen(fd,"wb");
+  if (fout == NULL) {
+    close(fd);
+    remove(tmpFile.c_str());
+    return;
+  }
+  int numCells = (nx_-1)*(ny_-1);
+  uint32_t header[4] = {GRID_CACHE_VERSION, (uint32_t)sizeof(CellRecord), (uint32_t)nx_, (uint32_t)ny_};
+  writeCacheArray(fout,"P3DCACHE",8);
+  writeCacheArray(fout,header,sizeof(header));
+  writeCacheArray(fout,&key,sizeof(key));
+  const Eigen::MatrixXd* cellMatD[8] = {&xCENT_, &yCENT_, &cellArea_, &Jxx_, &Jxy_, &Jyx_, &Jyy_, &Lmin_};
+  const Eigen::MatrixXf* cellMatF[4] = {&rhoCENT_, &uCENT_, &vCENT_, &ECENT_};
+  for (int m=0; m<8; m++) {
+    writeCacheArray(fout,cellMatD[m]->data(),numCells*sizeof(double));
+  }
+  for (int m=0; m<4; m++) {
+    writeCacheArray(fout,cellMatF[m]->data(),numCells*sizeof(float));
+  }
+  writeCacheArray(fout,cells_.data(),numCells*sizeof(CellRecord));
+  writeCacheArray(fout,&nWake_,sizeof(int));
+  writeCacheArray(fout,neighbors_.data(),neighbors_.size()*sizeof(int));
+  QT_.writeTree(fout);
+  bool ok = (ferror(fout) == 0);
+  ok = (fclose(fout) == 0) && ok;
+  if (!ok || (rename(tmpFile.c_str(),cacheFile.c_str()) != 0)) {
+    remove(tmpFile.c_str());
+  }
+
+}
+
+static inline bool isSpace(char c) {
+  return (c == ' ') || (c == '\n') || (c == '\r') || (c == '\t') || (c == '\f') || (c == '\v');
+}
+
+static inline int32_t readInt(const char* buf, size_t pos) {
+  int32_t val;
+  memcpy(&val, buf+pos, sizeof(int32_t));
+  return val;
+}
+
+static void gridError(const char *filename, const char *msg) {
+  // Report a mesh or solution file which cannot be read and stop (reading
+  // on would run past the end of the mapped file)
+  fprintf(stderr,"PLOT3D: %s: %s\n",filename,msg);
+  exit(EXIT_FAILURE);
+}
+
+static double parseToken(const char* begin, const char* end) {
+  // Convert one token with strtod, from a NUL-terminated copy (the mapped
+  // file is not terminated); Fortran 'D' exponents are accepted
+
+  char tok[64];
+  size_t len = std::min((size_t)(end-begin),sizeof(tok)-1);
+  for (size_t k=0; k<len; k++) {
+    tok[k] = ((begin[k] == 'D') || (begin[k] == 'd')) ? 'E' : begin[k];
+  }
+  tok[len] = '\0';
+
+  return strtod(tok,NULL);
+}
+
+void PLOT3D::readMesh(const char *meshfname, double chord) {
+  // Function to read a 2D single-block PLOT3D grid: ASCII, or binary
+  // (C-style or Fortran unformatted, single or double precision)
+
+  MappedFile file(meshfname);
+  const char* buf = file.data();
+  size_t size = file.size();
+  if (size == 0) {
+    gridError(meshfname,"empty grid file");
+  }
+  // Binary files are told apart by the zero bytes of their header ints
+  bool ascii = true;
+  for (size_t k=0; k<std::min(size,(size_t)64); k++) {
+    if (!isprint((unsigned char)buf[k]) && !isSpace(buf[k])) {
+      ascii = false;
+    }
+  }
+  if (ascii) {
+    this->readMeshASCII(buf,size,chord,meshfname);
+  }
+  else {
+    this->readMeshBinary(buf,size,chord,meshfname);
+  }
+
+}
+
+void PLOT3D::readMeshASCII(const char* buf, size_t size, double chord, const char *meshfname) {
+  // Function to parse an ASCII grid: header ints (nx ny, optionally
+  // preceded by the number of blocks and followed by nz and others), then
+  // all x and all y. The file is split at whitespace into chunks which
+  // are parsed in parallel, straight into x_/y_
+
+  // Split into chunks, then count the tokens starting in each chunk
+  int numChunks = (size < (1 << 16)) ? 1 : 8*getMaxThreads();
+  vector<size_t> bounds(numChunks+1);
+  bounds[0] = 0;
+  for (int c=1; c<=numChunks; c++) {
+    size_t b = (size*c)/numChunks;
+    while ((b < size) && !isSpace(buf[b])) {
+      b++;
+    }
+    bounds[c] = b;
+  }
+  vector<long> count(numChunks+1,0);
+#pragma omp parallel for schedule(static)
+  for (int c=0; c<numChunks; c++) {
+    long num = 0;
+    bool inToken = false;
+    for (size_t k=bounds[c]; k<bounds[c+1]; k++) {
+      bool space = isSpace(buf[k]);
+      if (!space && !inToken) {
+        num++;
+      }
+      inToken = !space;
+    }
+    count[c+1] = num;
+  }
+  for (int c=0; c<numChunks; c++) {
+    count[c+1] += count[c];
+  }
+  long numTokens = count[numChunks];
+  // Header: the first (or, after a block count, the second) pair of ints
+  // which accounts for all remaining tokens
+  long head[5];
+  size_t k = 0;
+  for (int t=0; t<5; t++) {
+    while ((k < size) && isSpace(buf[k])) k++;
+    size_t start = k;
+    while ((k < size) && !isSpace(buf[k])) k++;
+    head[t] = (long)parseToken(buf+start,buf+k);
+  }
+  int numHeader = -1;
+  for (int o=0; (o<2) && (numHeader<0); o++) {
+    long h = numTokens - 2*head[o]*head[o+1];
+    if ((h >= o+2) && (h <= 4) && (head[o] >= 2) && (head[o+1] >= 2)) {
+      nx_ = head[o];
+      ny_ = head[o+1];
+      numHeader = h;
+    }
+  }
+  if (numHeader < 0) {
+    gridError(meshfname,"grid dimensions do not match the number of values");
+  }
+  long n = (long)nx_*ny_;
+  x_.resize(nx_,ny_);
+  y_.resize(nx_,ny_);
+  double* x = x_.data();
+  double* y = y_.data();
+  // Parse; token t (after the header) is x(t) for t < n, else y(t-n)
+#pragma omp parallel for schedule(static)
+  for (int c=0; c<numChunks; c++) {
+    long t = count[c];
+    size_t k = bounds[c];
+    while (k < bounds[c+1]) {
+      while ((k < bounds[c+1]) && isSpace(buf[k])) k++;
+      if (k == bounds[c+1]) {
+        break;
+      }
+      size_t start = k;
+      while ((k < size) && !isSpace(buf[k])) k++;
+      long m = t - numHeader;
+      if (m >= 0) {
+        double val = chord*parseToken(buf+start,buf+k);
+        if (m < n) {
+          x[m] = val;
+        }
+        else {
+          y[m-n] = val;
+        }
+      }
+      t++;
+    }
+  }
+
+}
+
+void PLOT3D::readMeshBinary(const char* buf, size_t size, double chord, const char *meshfname) {
+  // Function to read a binary grid. Fortran unformatted files frame each
+  // record with its length in bytes: [nblocks] (nx ny [nz]) (x y [iblank]).
+  // C-style files hold the same without the framing; the layout is then
+  // found from the file size
+
+  size_t pos = 0;
+  size_t dataBytes = 0;
+  int realSize = 0;
+  if (size < 16) {
+    gridError(meshfname,"grid file is too short");
+  }
+  int32_t first = readInt(buf,0);
+  bool fortran = (((first == 4) || (first == 8) || (first == 12)) && (size >= (size_t)first+8) &&
+                  (readInt(buf,first+4) == first));
+  if (fortran) {
+    int32_t rec = first;
+    pos = 4;
+    if (rec == 4) {
+      // Number of blocks
+      if (readInt(buf,pos) != 1) {
+        gridError(meshfname,"only single-block grids are supported");
+      }
+      pos += 8;
+      rec = readInt(buf,pos);
+      pos += 4;
+    }
+    if ((rec < 8) || (pos + rec + 8 > size)) {
+      gridError(meshfname,"unrecognized Fortran record layout");
+    }
+    nx_ = readInt(buf,pos);
+    ny_ = readInt(buf,pos+4);
+    pos += rec + 4;
+    dataBytes = readInt(buf,pos);
+    pos += 4;
+    long n = (long)nx_*ny_;
+    // Coordinates (optionally followed by iblank ints)
+    if ((dataBytes == (size_t)16*n) || (dataBytes == (size_t)20*n)) {
+      realSize = 8;
+    }
+    else if ((dataBytes == (size_t)8*n) || (dataBytes == (size_t)12*n)) {
+      realSize = 4;
+    }
+  }
+  else {
+    for (int o=0; (o<2) && (realSize==0); o++) {
+      long n = (long)readInt(buf,4*o)*readInt(buf,4*o+4);
+      for (int h=o+2; (h<=4) && (realSize==0); h++) {
+        for (int s=8; s>=4; s-=4) {
+          size_t coords = 4*h + 2*n*s;
+          if ((size == coords) || (size == coords + 4*n)) {
+            nx_ = readInt(buf,4*o);
+            ny_ = readInt(buf,4*o+4);
+            pos = 4*h;
+            realSize = s;
+            break;
+          }
+        }
+      }
+    }
+  }
+  if ((realSize == 0) || (nx_ < 2) || (ny_ < 2)) {
+    gridError(meshfname,"unrecognized binary grid layout");
+  }
+  long n = (long)nx_*ny_;
+  if (pos + 2*n*realSize > size) {
+    gridError(meshfname,"grid file is too short for its dimensions");
+  }
+  x_.resize(nx_,ny_);
+  y_.resize(nx_,ny_);
+  const char* xy = buf + pos;
+#pragma omp parallel for schedule(static)
+  for (long k=0; k<n; k++) {
+    if (realSize == 8) {
+      double xk, yk;
+      memcpy(&xk, xy + 8*k, 8);
+      memcpy(&yk, xy + 8*(n+k), 8);
+      x_(k) = chord*xk;
+      y_(k) = chord*yk;
+    }
+    else {
+      float xk, yk;
+      memcpy(&xk, xy + 4*k, 4);
+      memcpy(&yk, xy + 4*(n+k), 4);
+      x_(k) = chord*xk;
+      y_(k) = chord*yk;
+    }
+  }
+
+}
+
+void PLOT3D::readSolution(const char *solnfname) {
+  // Function to read the (single precision) q-file: nx ny, then mach,
+  // alpha, reynolds, time, then rho, rho*u, rho*v, rho*E. C-style or
+  // Fortran unformatted (records framed by their length in bytes)
+
+  MappedFile file(solnfname);
+  const char* buf = file.data();
+  size_t size = file.size();
+  long n = (long)nx_*ny_;
+  bool fortran = ((size >= 16) && (readInt(buf,0) == 8) && (readInt(buf,12) == 8));
+  size_t posDims = fortran ? 4 : 0;
+  size_t posScalars = fortran ? 20 : 8;
+  size_t posData = fortran ? 44 : 24;
+  if (size < posData) {
+    gridError(solnfname,"solution file is too short");
+  }
+  if ((readInt(buf,posDims) != nx_) || (readInt(buf,posDims+4) != ny_)) {
+    gridError(solnfname,"solution dimensions do not match the mesh");
+  }
+  if (posData + 16*n > size) {
+    gridError(solnfname,"solution file is too short for its dimensions");
+  }
+  // Read in mach,alpha,reynolds,time
+  memcpy(&mach_, buf+posScalars, sizeof(float));
+  memcpy(&alpha_, buf+posScalars+4, sizeof(float));
+  memcpy(&reynolds_, buf+posScalars+8, sizeof(float));
+  memcpy(&time_, buf+posScalars+12, sizeof(float));
   Uinf_ = mach_*sqrt(1.4*R_*Tinf_);
-  // Read in solution data
+  // Read in solution data straight into place
   rho_.resize(nx_,ny_);
   u_.resize(nx_,ny_);
   v_.resize(nx_,ny_);
   E_.resize(nx_,ny_);
   P_.resize(nx_,ny_);
-  float rhoTMP[nx_*ny_];
-  float uTMP[nx_*ny_];
-  float vTMP[nx_*ny_];
-  float ETMP[nx_*ny_];
-  fread(&rhoTMP, sizeof(float), nx_*ny_, solnfile);
-  fread(&uTMP, sizeof(float), nx_*ny_, solnfile);
-  fread(&vTMP, sizeof(float), nx_*ny_, solnfile);
-  fread(&ETMP, sizeof(float), nx_*ny_, solnfile);
-  iter = 0;
+  memcpy(rho_.data(), buf+posData,       n*sizeof(float));
+  memcpy(u_.data(),   buf+posData+4*n,   n*sizeof(float));
+  memcpy(v_.data(),   buf+posData+8*n,   n*sizeof(float));
+  memcpy(E_.data(),   buf+posData+12*n,  n*sizeof(float));
   // Normalize solution data
-  for (int j=0; j<ny_; j++) {
-    for (int i=0; i<nx_; i++) {
-      rho_(i,j) = rhoinf_*rhoTMP[iter];
-      u_(i,j) = Ubar_*rhoinf_*uTMP[iter]/rho_(i,j);
-      v_(i,j) = Ubar_*rhoinf_*vTMP[iter]/rho_(i,j);
-      E_(i,j) = pow(Ubar_,2)*rhoinf_*ETMP[iter]/rho_(i,j);
-      P_(i,j) = 0.4*rho_(i,j)*(E_(i,j) - 0.5*(pow(u_(i,j),2)+pow(v_(i,j),2)));
-      iter++;
-    }
+#pragma omp parallel for schedule(static)
+  for (long k=0; k<n; k++) {
+    rho_(k) = rhoinf_*rho_(k);
+    u_(k) = Ubar_*rhoinf_*u_(k)/rho_(k);
+    v_(k) = Ubar_*rhoinf_*v_(k)/rho_(k);
+    E_(k) = pow(Ubar_,2)*rhoinf_*E_(k)/rho_(k);
+    P_(k) = 0.4*rho_(k)*(E_(k) - 0.5*(pow(u_(k),2)+pow(v_(k),2)));
   }
-  // Initialize searcher object
-  QT_.setOutDir(workdir);
-  this->computeCellCenters();
-  this->computeCellAreas();
-  this->computeGridMetrics();
-  this->createQuadTree();
-  // Close input streams/files, free any allocated memory
-  delete[] xy;
-  meshfile.close();
-  fclose(solnfile);
+
 }
 
 PLOT3D::~PLOT3D() {
@@ -93,34 +466,34 @@ PLOT3D::~PLOT3D() {
   
 }
 
-MatrixXd PLOT3D::getX() {
+const MatrixXd& PLOT3D::getX() {
   return x_;
 }
-MatrixXd PLOT3D::getY() {
+const MatrixXd& PLOT3D::getY() {
   return y_;
 }
-MatrixXf PLOT3D::getRHO() {
+const MatrixXf& PLOT3D::getRHO() {
   return rho_;
 }
-MatrixXf PLOT3D::getU() {
+const MatrixXf& PLOT3D::getU() {
   return u_;
 }
-MatrixXf PLOT3D::getV() {
+const MatrixXf& PLOT3D::getV() {
   return v_;
 }
-MatrixXf PLOT3D::getE() {
+const MatrixXf& PLOT3D::getE() {
   return E_;
 }
-MatrixXf PLOT3D::getP() {
+const MatrixXf& PLOT3D::getP() {
   return P_;
 }
-MatrixXd PLOT3D::getXCENT() {
+const MatrixXd& PLOT3D::getXCENT() {
   return xCENT_;
 }
-MatrixXd PLOT3D::getYCENT() {
+const MatrixXd& PLOT3D::getYCENT() {
   return yCENT_;
 }
-MatrixXd PLOT3D::getLMIN() {
+const MatrixXd& PLOT3D::getLMIN() {
   return Lmin_;
 }
 double PLOT3D::getX(int ind) {
@@ -144,24 +517,6 @@ float PLOT3D::getE(int ind) {
 float PLOT3D::getP(int ind) {
   return P_(ind);
 }
-double PLOT3D::getXCENT(int ind) {
-  return xCENT_(ind);
-}
-double PLOT3D::getYCENT(int ind) {
-  return yCENT_(ind);
-}
-double PLOT3D::getRHOCENT(int ind) {
-  return rhoCENT_(ind);
-}
-double PLOT3D::getUCENT(int ind) {
-  return uCENT_(ind);
-}
-double PLOT3D::getVCENT(int ind) {
-  return vCENT_(ind);
-}
-double PLOT3D::getLMIN(int ind) {
-  return Lmin_(ind);
-}
 
 void PLOT3D::getPROPS(FluidScalars& PROPS) {
   // Function to return [nx,ny,mach,alpha,reynolds,time]
@@ -258,6 +613,84 @@ void PLOT3D::computeGridMetrics() {
 
 }
 
+void PLOT3D::computeCellRecords() {
+  // Function to pack the cell data used by the particle kernels into one
+  // record per cell
+
+  int numCells = (nx_-1)*(ny_-1);
+  cells_.resize(numCells);
+  for (int c=0; c<numCells; c++) {
+    CellRecord& cell = cells_[c];
+    double area = cellArea_(c);
+    cell.xC = xCENT_(c);
+    cell.yC = yCENT_(c);
+    cell.Lmin = Lmin_(c);
+    cell.rho = rhoCENT_(c);
+    cell.u = uCENT_(c);
+    cell.v = vCENT_(c);
+    cell.dIdx = Jyy_(c)/area;
+    cell.dIdy = -Jxy_(c)/area;
+    cell.dJdx = -Jyx_(c)/area;
+    cell.dJdy = Jxx_(c)/area;
+    cell.orient = (Jxx_(c)*Jyy_(c) - Jxy_(c)*Jyx_(c) < 0) ? -1.0f : 1.0f;
+  }
+
+}
+
+void PLOT3D::computeWakeCut() {
+  // Function to find the wake cut of the C-grid: the nodes of the first
+  // grid line which coincide pairwise from both ends, up to the trailing
+  // edge
+
+  double tol = 1e-9*std::max(x_.cwiseAbs().maxCoeff(),y_.cwiseAbs().maxCoeff());
+  int i = 0;
+  while ((i < nx_/2) && (std::abs(x_(i,0)-x_(nx_-1-i,0)) <= tol) && (std::abs(y_(i,0)-y_(nx_-1-i,0)) <= tol)) {
+    i++;
+  }
+  // Nodes 0..i-1 lie on the cut (node i-1 is the trailing edge)
+  nWake_ = std::max(i-1,0);
+
+}
+
+void PLOT3D::computeNeighbors() {
+  // Function to build the table of cell neighbors. Cells of the first row
+  // in the wake face their partner across the cut (whose I direction is
+  // reversed); the rest of the first row faces the airfoil (WALL). The
+  // outer row and the two ends of the C face the far field/outflow.
+  // Diagonal neighbors are reached through the east/west neighbor, so
+  // they also follow the cut
+
+  int nI = nx_-1;
+  int nJ = ny_-1;
+  int numCells = nI*nJ;
+  neighbors_.resize(8*numCells);
+  for (int j=0; j<nJ; j++) {
+    for (int i=0; i<nI; i++) {
+      int* nb = &neighbors_[8*(i+j*nI)];
+      nb[NORTH] = (j < nJ-1) ? (i+(j+1)*nI) : OUTFLOW;
+      if (j > 0) {
+        nb[SOUTH] = i+(j-1)*nI;
+      }
+      else if ((i < nWake_) || (i >= nI-nWake_)) {
+        nb[SOUTH] = nI-1-i;
+      }
+      else {
+        nb[SOUTH] = WALL;
+      }
+      nb[EAST] = (i < nI-1) ? (i+1+j*nI) : OUTFLOW;
+      nb[WEST] = (i > 0) ? (i-1+j*nI) : OUTFLOW;
+    }
+  }
+  for (int c=0; c<numCells; c++) {
+    int* nb = &neighbors_[8*c];
+    nb[SOUTHWEST] = (nb[WEST] < 0) ? nb[WEST] : neighbors_[8*nb[WEST]+SOUTH];
+    nb[SOUTHEAST] = (nb[EAST] < 0) ? nb[EAST] : neighbors_[8*nb[EAST]+SOUTH];
+    nb[NORTHWEST] = (nb[WEST] < 0) ? nb[WEST] : neighbors_[8*nb[WEST]+NORTH];
+    nb[NORTHEAST] = (nb[EAST] < 0) ? nb[EAST] : neighbors_[8*nb[EAST]+NORTH];
+  }
+
+}
+
 void PLOT3D::transformXYtoIJ(int ind, Eigen::MatrixXd& xq, Eigen::MatrixXd& yq, Eigen::MatrixXd& Iq, Eigen::MatrixXd& Jq) {
   // Function to transform physical domain coordinates (x,y) to computational 
   // domain coordinates (I,J), centered at cell center 'ind'
@@ -282,38 +715,106 @@ void PLOT3D::transformXYtoIJ(int ind, Eigen::MatrixXd& xq, Eigen::MatrixXd& yq,
 
 }
 
-void PLOT3D::transformXYtoIJ(int ind, double xq, double yq, double& Iq, double& Jq) {
-  // Function to transform a single query point from physical domain coordinates (x,y)
-  // to computational domain coordinates (I,J), centered at cell center 'ind'
-  
-  double xC = xCENT_(ind);
-  double yC = yCENT_(ind);
-  double area = cellArea_(ind);
-  double Jxx = Jxx_(ind);
-  double Jxy = Jxy_(ind);
-  double Jyx = Jyx_(ind);
-  double Jyy = Jyy_(ind);
+void PLOT3D::calcEdgeDist(int ind, double xq, double yq, double* edge) {
+  // Function to compute the signed distances (times edge length) of a
+  // query point from the south, east, north and west edges of cell 'ind';
+  // all are >= 0 for a point inside the cell
 
-  // Inverse Jacobian transformation
-  double X = xq - xC;
-  double Y = yq - yC;
-  Iq = (X*Jyy - Y*Jxy)/area;
-  Jq = (-X*Jyx + Y*Jxx)/area;
+  int i = ind % (nx_-1);
+  int j = ind / (nx_-1);
+  // Orientation of the cell in the physical plane
+  double s = cells_[ind].orient;
+  double xa = x_(i,j),     ya = y_(i,j);
+  double xb = x_(i+1,j),   yb = y_(i+1,j);
+  double xc = x_(i+1,j+1), yc = y_(i+1,j+1);
+  double xd = x_(i,j+1),   yd = y_(i,j+1);
+  edge[0] = s*((xb-xa)*(yq-ya) - (yb-ya)*(xq-xa));
+  edge[1] = s*((xc-xb)*(yq-yb) - (yc-yb)*(xq-xb));
+  edge[2] = s*((xd-xc)*(yq-yc) - (yd-yc)*(xq-xc));
+  edge[3] = s*((xa-xd)*(yq-yd) - (ya-yd)*(xq-xd));
+
+}
+
+bool PLOT3D::isInCell(int ind, double xq, double yq) {
+  // Function to test whether a query point lies inside (or on the
+  // boundary of) cell 'ind'
+
+  double edge[4];
+  this->calcEdgeDist(ind,xq,yq,edge);
+
+  return ((edge[0] >= 0) && (edge[1] >= 0) && (edge[2] >= 0) && (edge[3] >= 0));
+}
+
+int PLOT3D::locateCell(double xq, double yq, int& cell) {
+  // Function to find the cell containing a query point by walking through
+  // the grid from 'cell' (or from the cell with the nearest center, if
+  // cell < 0). On return 'cell' holds the containing cell, or the last
+  // cell reached before the walk left the grid; the return value is the
+  // containing cell, or WALL/OUTFLOW if the point is inside the airfoil
+  // or beyond the far-field/outflow boundaries
+
+  bool seeded = (cell < 0);
+  if (seeded) {
+    double xnn,ynn;
+    this->pointSearch(xq,yq,xnn,ynn,cell);
+  }
+  int last = cell;
+  int found = this->walkToCell(xq,yq,last);
+  if ((found < 0) && !seeded) {
+    // A long walk may run into the airfoil (or a boundary) on its way
+    // around it: try again from the cell with the nearest center
+    int retry;
+    double xnn,ynn;
+    this->pointSearch(xq,yq,xnn,ynn,retry);
+    found = this->walkToCell(xq,yq,retry);
+    if (found >= 0) {
+      last = retry;
+    }
+  }
+  cell = last;
+
+  return found;
+}
+
+int PLOT3D::walkToCell(double xq, double yq, int& cell) {
+  // Function to walk from 'cell' towards a query point, crossing one cell
+  // edge per step (see locateCell)
+
+  // Table directions of the south, east, north and west edges
+  static const int edgeDir[4] = {SOUTH, EAST, NORTH, WEST};
+  int maxSteps = (nx_-1) + (ny_-1);
+  for (int step=0; step<maxSteps; step++) {
+    double edge[4];
+    this->calcEdgeDist(cell,xq,yq,edge);
+    // Of the edges the point is outside of, cross the one in the direction
+    // the point lies farthest in the transformed (I,J) plane
+    double Iq,Jq;
+    this->transformXYtoIJ(cell,xq,yq,Iq,Jq);
+    double weight[4] = {std::abs(Jq), std::abs(Iq), std::abs(Jq), std::abs(Iq)};
+    int k = -1;
+    for (int e=0; e<4; e++) {
+      if ((edge[e] < 0) && ((k < 0) || (weight[e] > weight[k]))) {
+        k = e;
+      }
+    }
+    if (k < 0) {
+      return cell;
+    }
+    int next = neighbors_[8*cell+edgeDir[k]];
+    if (next < 0) {
+      return next;
+    }
+    cell = next;
+  }
+  // The walk did not settle (strongly skewed cells); use the last cell
+  return cell;
 
 }
 
 void PLOT3D::createQuadTree() {
-  // Function to create a quadtree searcher of the grid cell centers
+  // Function to create a quadtree searcher of the grid cell centers (the
+  // tree is built on the bounding box of the cell centers)
   
-  // Set bounds of quadtree object
-  double minX,minY,maxX,maxY;
-  minX = xCENT_.minCoeff(); maxX = xCENT_.maxCoeff();
-  minY = yCENT_.minCoeff(); maxY = yCENT_.maxCoeff();
-  double SW[2] = {minX, minY};
-  double SE[2] = {maxX, minY};
-  double NW[2] = {minX, maxY};
-  double NE[2] = {maxX, maxY};
-  QT_.setBounds(&SW[0],&SE[0],&NW[0],&NE[0]);
   // Create quadtree search object
   QT_.calcQuadTree(xCENT_.data(),yCENT_.data(),(nx_-1)*(ny_-1));
 
@@ -326,10 +827,18 @@ void PLOT3D::pointSearch(double xq, double yq, double& xnn, double& ynn, int& in
 
 }
 
-MatrixXf PLOT3D::getUCENT() {
+void PLOT3D::pointSearch(int n, const double* xq, const double* yq, double* xnn, double* ynn, int* indnn) {
+  // Function to search the quadtree for a batch of n query points
+  // (xnn/ynn may be NULL)
+
+  QT_.knnSearch(n,xq,yq,xnn,ynn,indnn);
+
+}
+
+const MatrixXf& PLOT3D::getUCENT() {
   return uCENT_;
 }
 
-MatrixXf PLOT3D::getVCENT() {
+const MatrixXf& PLOT3D::getVCENT() {
   return vCENT_;
 }
@@ -6,31 +6,49 @@
 #include <fstream>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <vector>
 #include <eigen3/Eigen/Dense>
 #include "FluidScalars.h"
 #include <QuadTree/Bucket.h>
+#include "AlignedAllocator.h"
 
 using namespace std;
 
+// Everything the particle kernels read for one cell (advection, timestep,
+// relocation), packed into a single cache line
+struct alignas(64) CellRecord {
+  double xC, yC;                  // cell center
+  double Lmin;                    // minimum cell length (CFL condition)
+  float rho, u, v;                // gas state at the cell center
+  float dIdx, dIdy, dJdx, dJdy;   // inverse Jacobian (x,y) -> (I,J)
+  float orient;                   // +1/-1: orientation of the cell in (x,y)
+};
+static_assert(sizeof(CellRecord) == 64, "CellRecord must fill one cache line");
+
 class PLOT3D {
  public:
   // Constructor: read in mesh/soln
   PLOT3D(const char *meshfname, const char *solnfname, FluidScalars* scalars, const std::string workdir);
   ~PLOT3D();
+  // Read methods
+  void readMesh(const char *meshfname, double chord);
+  void readSolution(const char *solnfname);
   // Get methods
-  Eigen::MatrixXd getX();      double getX(int ind);
-  Eigen::MatrixXd getY();      double getY(int ind);
-  Eigen::MatrixXf getRHO();    float  getRHO(int ind);
-  Eigen::MatrixXf getU();      float  getU(int ind);
-  Eigen::MatrixXf getV();      float  getV(int ind);
-  Eigen::MatrixXf getE();      float  getE(int ind);
-  Eigen::MatrixXf getP();      float  getP(int ind);
-  Eigen::MatrixXd getXCENT();  double getXCENT(int ind);
-  Eigen::MatrixXd getYCENT();  double getYCENT(int ind);
-  Eigen::MatrixXd getLMIN();   double getLMIN(int ind);
-                               double getRHOCENT(int ind);
-  Eigen::MatrixXf getUCENT();  double getUCENT(int ind);
-  Eigen::MatrixXf getVCENT();  double getVCENT(int ind);
+  const Eigen::MatrixXd& getX();      double getX(int ind);
+  const Eigen::MatrixXd& getY();      double getY(int ind);
+  const Eigen::MatrixXf& getRHO();    float  getRHO(int ind);
+  const Eigen::MatrixXf& getU();      float  getU(int ind);
+  const Eigen::MatrixXf& getV();      float  getV(int ind);
+  const Eigen::MatrixXf& getE();      float  getE(int ind);
+  const Eigen::MatrixXf& getP();      float  getP(int ind);
+  // Per-cell accessors used inside the advection loops are inlined below
+  const Eigen::MatrixXd& getXCENT();  inline double getXCENT(int ind);
+  const Eigen::MatrixXd& getYCENT();  inline double getYCENT(int ind);
+  const Eigen::MatrixXd& getLMIN();   inline double getLMIN(int ind);
+                                      inline double getRHOCENT(int ind);
+  const Eigen::MatrixXf& getUCENT();  inline double getUCENT(int ind);
+  const Eigen::MatrixXf& getVCENT();  inline double getVCENT(int ind);
   void getPROPS(FluidScalars& PROPS);
   int getNX();
   int getNY();
@@ -39,11 +57,26 @@ class PLOT3D {
   void computeCellAreas();
   void computeCellCenters();
   void computeGridMetrics();
+  void computeCellRecords();
+  inline const CellRecord& getCell(int ind);
   void transformXYtoIJ(int ind, Eigen::MatrixXd& xq, Eigen::MatrixXd& yq, Eigen::MatrixXd& Iq, Eigen::MatrixXd& Jq);
-  void transformXYtoIJ(int ind, double xq, double yq, double& Iq, double& Jq);
+  inline void transformXYtoIJ(int ind, double xq, double yq, double& Iq, double& Jq);
   // QuadTree methods
   void createQuadTree();
   void pointSearch(double xq, double yq, double& xnn, double& ynn, int& indnn);
+  void pointSearch(int n, const double* xq, const double* yq, double* xnn, double* ynn, int* indnn);
+  // Cell location methods (walk through the structured grid)
+  int locateCell(double xq, double yq, int& cell);
+  bool isInCell(int ind, double xq, double yq);
+  // Cell neighbors, in the order [N,S,E,W,SW,SE,NW,NE]; sentinels WALL
+  // and OUTFLOW mark the airfoil surface and the far-field/outflow
+  // boundaries (also returned by locateCell)
+  enum { NORTH, SOUTH, EAST, WEST, SOUTHWEST, SOUTHEAST, NORTHWEST, NORTHEAST };
+  static const int WALL = -1;
+  static const int OUTFLOW = -2;
+  inline int getNeighbor(int ind, int dir);
+  inline const int* getNeighbors(int ind);
+  void computeNeighbors();
   
  private:
   // Grid coordinates/solution
@@ -72,7 +105,67 @@ class PLOT3D {
   Eigen::MatrixXd Jyx_;
   Eigen::MatrixXd Jyy_;
   Eigen::MatrixXd Lmin_;
+  // Number of cells on each side of the wake cut (cell i of the first row
+  // faces cell nx-2-i across the cut for i < nWake_)
+  int nWake_;
+  void computeWakeCut();
+  // Neighbor table, 8 entries per cell
+  std::vector<int> neighbors_;
+  // Packed per-cell records for the particle kernels
+  std::vector<CellRecord, AlignedAllocator<CellRecord,64> > cells_;
+  void readMeshASCII(const char* buf, size_t size, double chord, const char *meshfname);
+  // Cache of the derived grid data
+  uint64_t calcCacheKey(const char *meshfname, const char *solnfname, double chord);
+  bool readCache(const std::string& cacheFile, uint64_t key);
+  void writeCache(const std::string& cacheFile, uint64_t key);
+  void readMeshBinary(const char* buf, size_t size, double chord, const char *meshfname);
+  void calcEdgeDist(int ind, double xq, double yq, double* edge);
+  int walkToCell(double xq, double yq, int& cell);
   // QuadTree object
   Bucket QT_;
 };
+
+inline double PLOT3D::getXCENT(int ind) {
+  return xCENT_(ind);
+}
+inline double PLOT3D::getYCENT(int ind) {
+  return yCENT_(ind);
+}
+inline double PLOT3D::getRHOCENT(int ind) {
+  return rhoCENT_(ind);
+}
+inline double PLOT3D::getUCENT(int ind) {
+  return uCENT_(ind);
+}
+inline double PLOT3D::getVCENT(int ind) {
+  return vCENT_(ind);
+}
+inline double PLOT3D::getLMIN(int ind) {
+  return Lmin_(ind);
+}
+inline const CellRecord& PLOT3D::getCell(int ind) {
+  return cells_[ind];
+}
+inline int PLOT3D::getNeighbor(int ind, int dir) {
+  return neighbors_[8*ind+dir];
+}
+inline const int* PLOT3D::getNeighbors(int ind) {
+  return &neighbors_[8*ind];
+}
+
+inline void PLOT3D::transformXYtoIJ(int ind, double xq, double yq, double& Iq, double& Jq) {
+  // Function to transform a single query point from physical domain coordinates (x,y)
+  // to computational domain coordinates (I,J), centered at cell center 'ind'
+  // (from the packed cell record, so to single precision)
+  
+  const CellRecord& cell = cells_[ind];
+
+  // Inverse Jacobian transformation
+  double X = xq - cell.xC;
+  double Y = yq - cell.yC;
+  Iq = X*cell.dIdx + Y*cell.dIdy;
+  Jq = X*cell.dJdx + Y*cell.dJdy;
+
+}
+
 #endif // PLOT3D_H
@@ -9,6 +9,7 @@ from matplotlib.ticker import LinearLocator, FormatStrFormatter, ScalarFormatter
 import matplotlib.pyplot as plt
 import numpy as np
 from matplotlib.pyplot import figure, axes, plot, xlabel, ylabel, title, grid, savefig, show
+from TrajectoryReader import readTrajectories
 
 inches_per_pt = 1.0/72.27
 ratio = 1.0
@@ -55,6 +56,11 @@ for k in range(0,np.size(RUN)):
             # plt.yticks([-0.04, 0.04])
             # plt.title(str(RUN[k]),fontweight='bold',fontsize=30);
     figure(2); plot(XY[:,0]*chord,XY[:,1]*chord,'b',linewidth=3); axis('equal'); plt.xlim([-0.02,0.1]); plt.tight_layout()
+    # Droplet positions recorded during the first shot, if any
+    trajFile = runsdir + "/" + str(RUN[k]) + AP + "/T0/DropletXY.bin";
+    if os.path.exists(trajFile):
+        traj = readTrajectories(trajFile);
+        plot(traj['x'],traj['y'],'r.',markersize=1,alpha=0.25);
 
     # ******************************************************
     # RUN (LEWICE COMPARISON)
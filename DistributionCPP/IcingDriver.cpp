@@ -14,6 +14,7 @@
 #include "Cloud/calcImpingementLimits.h"
 #include "ThermoEqns/ThermoEqns.h"
 #include "AutoGridGen/autoGridGen.h"
+#include "Output/TrajectoryWriter.h"
 #include <iterator>
 #include <findAll.h>
 
@@ -126,8 +127,8 @@ R"(#                        \____//_/  |_|/_/  /_/    /___/ /____//_/ /_/
   double massTotal = cloud.calcTotalMass();
   double fluxFreeStream = massTotal/dY;
   // Intialize airfoil object
-  Eigen::MatrixXd Xgrid = p3d.getX();
-  Eigen::MatrixXd Ygrid = p3d.getY();
+  const Eigen::MatrixXd& Xgrid = p3d.getX();
+  const Eigen::MatrixXd& Ygrid = p3d.getY();
   std::vector<double> X;
   std::vector<double> Y;
   int iter = 0;
@@ -140,21 +141,18 @@ R"(#                        \____//_/  |_|/_/  /_/    /___/ /____//_/ /_/
   }
   Airfoil airfoil = Airfoil(s_inDir,X,Y);
   airfoil.calcStagnationPt(p3d);
+  // Bin width (in s) for collection efficiency
+  double dS = 0.0025;
+  airfoil.setFilmBinWidth(dS);
   //airfoil.setStagPt(1.0238);
   // Advect (no splashing/fracture)
   State stateCloud;
   iter = 0;
   int totalImpinge = 0;
-  vector<double> x;
-  vector<double> y;
   vector<int> impinge;
   vector<int> totalImpingeInd;
   vector<int> indAdv;
-  vector<int> indCell;
   vector<int> indSplash;
-  double xCENT,yCENT;
-  vector<double> XCENT;
-  vector<double> YCENT;
   int indtmp = 0;
   int numSplash = 0;
   int numIndAdv = 0;
@@ -162,55 +160,74 @@ R"(#                        \____//_/  |_|/_/  /_/    /___/ /____//_/ /_/
   int refreshRate = scalarsParcel.refreshRate_;
   int particles = scalarsParcel.particles_;
   printf("maxiter = %d\n",maxiter);
+  printf("threads = %d\n",cloud.getNumThreads());
+  printf("advectMode = %d\n",scalarsParcel.advectMode_);
+  // Particle state history, streamed to file as it is recorded (only
+  // saved in lock-step mode, every refreshRate iterations)
+  const std::string s_dropName = s_inDir + "/DropletXY.bin";
+  TrajectoryWriter* trajectories = NULL;
+  if ((scalarsParcel.advectMode_ != 1) && (refreshRate > 0)) {
+    trajectories = new TrajectoryWriter(s_dropName,scalarsParcel.trajDecimation_);
+  }
   
   // *******************************************************
   // DROPLET ADVECTION MODULE
   // *******************************************************
   
-  while ((totalImpinge < particles) && (iter < maxiter)) {
-    cloud.calcDtandImpinge(airfoil,p3d);
-    cloud.transportSLD(p3d);
+  if (scalarsParcel.advectMode_ == 1) {
+    // Particle-major: carry every particle to impingement in one sweep,
+    // then repeat for the particles which bounced or splashed (particle
+    // state history is not saved in this mode)
+    cloud.advectToCompletion(airfoil,p3d,maxiter);
     impinge = cloud.getIMPINGE();
-    if (!impinge.empty()) {
+    while (!impinge.empty()) {
       cloud.computeImpingementRegimes(airfoil);
       cloud.bounceDynamics(airfoil);
       cloud.spreadDynamics(airfoil);
       cloud.splashDynamics(airfoil);
+      cloud.coalesceParcels();
+      stateCloud = cloud.getState();
+      particles = stateCloud.size_;
+      printf("PASS = %d\t%d\t%d\n",iter,particles,(int)impinge.size());
+      cloud.advectToCompletion(airfoil,p3d,maxiter);
+      impinge = cloud.getIMPINGE();
+      iter++;
     }
-    totalImpingeInd = cloud.getIMPINGETOTAL();
-    totalImpinge = totalImpingeInd.size();
-    stateCloud = cloud.getState();
-    particles = stateCloud.size_;
-    // Save states
-    if (iter % refreshRate==0) {
-      indCell = cloud.getINDCELL();
-      for (int i=0; i<particles; i++) {
-        x.push_back(stateCloud.x_(i));
-        y.push_back(stateCloud.y_(i));
+  }
+  else {
+    while ((totalImpinge < particles) && (iter < maxiter)) {
+      cloud.calcDtandImpinge(airfoil,p3d);
+      cloud.transportSLD(p3d);
+      impinge = cloud.getIMPINGE();
+      if (!impinge.empty()) {
+        cloud.computeImpingementRegimes(airfoil);
+        cloud.bounceDynamics(airfoil);
+        cloud.spreadDynamics(airfoil);
+        cloud.splashDynamics(airfoil);
+        cloud.coalesceParcels();
       }
-      for (int i=0; i<indCell.size(); i++) {
-        xCENT = p3d.getXCENT(indCell[i]);
-        yCENT = p3d.getYCENT(indCell[i]);
-        XCENT.push_back(xCENT);
-        YCENT.push_back(yCENT);
+      totalImpingeInd = cloud.getIMPINGETOTAL();
+      totalImpinge = totalImpingeInd.size();
+      stateCloud = cloud.getState();
+      particles = stateCloud.size_;
+      // Save states
+      if ((trajectories != NULL) && (iter % refreshRate==0)) {
+        trajectories->record(iter,stateCloud);
       }
-    }
-    indAdv = cloud.getIndAdv();
-    numIndAdv = indAdv.size();
-    printf("ITER = %d\t%d\t%d\n",iter,particles,numIndAdv);
-    iter++;
+      indAdv = cloud.getIndAdv();
+      numIndAdv = indAdv.size();
+      printf("ITER = %d\t%d\t%d\n",iter,particles,numIndAdv);
+      iter++;
 
+    }
+  }
+  // Finish writing particle state history
+  if (trajectories != NULL) {
+    trajectories->close();
+    delete trajectories;
   }
-  // Output particle state history to file
-  const std::string s_dropName = s_inDir + "/DropletXY.out";
-  FILE* outfileDROP;
-  outfileDROP = fopen(s_dropName.c_str(),"w");
-  for (int i=0; i<x.size(); i++)
-    fprintf(outfileDROP,"%lf\t%lf\n",x[i],y[i]);
-  fclose(outfileDROP);
   // Get collection efficiency and output to file
-  double dS = 0.0025;
-  airfoil.calcCollectionEfficiency(fluxFreeStream,dS);
+  airfoil.calcCollectionEfficiency(fluxFreeStream);
   std::vector<double> BetaBins = airfoil.getBetaBins();
   std::vector<double> Beta = airfoil.getBeta();
   FILE* outfileBETA;
@@ -25,4 +25,9 @@ int main(int argc, const char *argv[]) {
   printf("Tmean = %f\n",PARCEL.Tmean_);
   printf("Xmin = %f, Xmax = %f, Ymin = %f, Ymax = %f\n",PARCEL.Xmin_,PARCEL.Xmax_,PARCEL.Ymin_,PARCEL.Ymax_);
   printf("maxiter = %d\n",PARCEL.maxiter_);
+  printf("refreshRate = %d, trajDecimation = %d\n",PARCEL.refreshRate_,PARCEL.trajDecimation_);
+  printf("seed = %d\n",PARCEL.seed_);
+  printf("threads = %d\n",PARCEL.threads_);
+  printf("advectMode = %d\n",PARCEL.advectMode_);
+  printf("coalesce = %d, maxParcels = %d\n",PARCEL.CoalesceFlag_,PARCEL.maxParcels_);
 }
@@ -5,8 +5,70 @@
 #include <cmath>
 #include <string.h>
 #include <istream>
+#include <sstream>
+#include <vector>
 #include "readInputParams.h"
 
+static void inputError(const char *inFileName, const std::string& header, const char *msg) {
+  // Report a malformed input file and stop (a misread deck would silently
+  // run the wrong case)
+  fprintf(stderr,"readInputParams: %s: line '%s': %s\n",inFileName,header.c_str(),msg);
+  exit(EXIT_FAILURE);
+}
+
+static std::vector<double> readInputLine(std::ifstream& inFile, const char *inFileName, int numRequired,
+                                         const char* const* optional, int numOptional, const double* defaults) {
+  // Function to read one header line and the line of values below it
+  // (comment lines starting with "//" are skipped). The first numRequired
+  // values are always present; newer fields are appended at the end of
+  // the line, named in the header, and take their defaults when absent.
+  // The number of values must match the number of header entries
+
+  std::string header, line, token;
+  do {
+    if (!std::getline(inFile,header)) {
+      inputError(inFileName,header,"unexpected end of file");
+    }
+  } while ((header.compare(0,2,"//") == 0) || (header.find_first_not_of(" \t\r") == std::string::npos));
+  if (!std::getline(inFile,line)) {
+    inputError(inFileName,header,"missing line of values");
+  }
+  // Header entries
+  std::vector<std::string> names;
+  std::istringstream headerStream(header);
+  while (headerStream >> token) {
+    names.push_back(token);
+  }
+  int numNames = names.size();
+  if ((numNames < numRequired) || (numNames > numRequired + numOptional)) {
+    inputError(inFileName,header,"unexpected number of fields");
+  }
+  for (int i=numRequired; i<numNames; i++) {
+    if (names[i] != optional[i-numRequired]) {
+      inputError(inFileName,header,"unknown or misplaced field name");
+    }
+  }
+  // Values
+  std::vector<double> values;
+  std::istringstream lineStream(line);
+  while (lineStream >> token) {
+    char* end;
+    double value = strtod(token.c_str(),&end);
+    if ((end == token.c_str()) || (*end != '\0')) {
+      inputError(inFileName,header,"value is not a number");
+    }
+    values.push_back(value);
+  }
+  if ((int)values.size() != numNames) {
+    inputError(inFileName,header,"number of values does not match the header");
+  }
+  for (int i=numNames; i<numRequired+numOptional; i++) {
+    values.push_back(defaults[i-numRequired]);
+  }
+
+  return values;
+}
+
 void readInputParams(FluidScalars& PROPS, ParcelScalars& PARCEL, const char *inFileName) {
   // Function to read in simulation parameters from specified input
   // file and return them in a property struct
@@ -15,48 +77,62 @@ void readInputParams(FluidScalars& PROPS, ParcelScalars& PARCEL, const char *inF
   // INITIALIZE INPUT FILE STREAM
   // **********************************
 
-  std::string line = "";
   std::ifstream inFile;
   inFile.open(inFileName);
+  if (!inFile.is_open()) {
+    inputError(inFileName,"","cannot open file");
+  }
+  std::vector<double> v;
 
   // **********************************
   // DROPLET ADVECTION PARAMETERS
   // **********************************
   
-  // Scan through headers
-  for (int i=0; i<4; i++)
-    std::getline(inFile,line);
   // Physical parameters (pinf,R,Tinf,rhol)
-  inFile >> PROPS.pinf_;
-  inFile >> PROPS.R_;
-  inFile >> PROPS.Tinf_;
-  inFile >> PROPS.rhol_;
+  v = readInputLine(inFile,inFileName,4,NULL,0,NULL);
+  PROPS.pinf_ = v[0];
+  PROPS.R_    = v[1];
+  PROPS.Tinf_ = v[2];
+  PROPS.rhol_ = v[3];
   // Parcel cloud properties (particles,Rmean,Tmean)
-  std::getline(inFile,line);
-  std::getline(inFile,line);
-  inFile >> PARCEL.particles_;
-  inFile >> PARCEL.Rmean_;
-  inFile >> PARCEL.Tmean_;
+  v = readInputLine(inFile,inFileName,3,NULL,0,NULL);
+  PARCEL.particles_ = (int)v[0];
+  PARCEL.Rmean_     = v[1];
+  PARCEL.Tmean_     = v[2];
   // Domain box properties (Xmin,Xmax,Ymin,Ymax)
-  std::getline(inFile,line);
-  std::getline(inFile,line);
-  inFile >> PARCEL.Xmin_;
-  inFile >> PARCEL.Xmax_;
-  inFile >> PARCEL.Ymin_;
-  inFile >> PARCEL.Ymax_;
-  // Simulation properties (maxiter)
-  std::getline(inFile,line);
-  std::getline(inFile,line);
-  inFile >> PARCEL.maxiter_;
-  // Driver refresh rate (refreshRate)
-  inFile >> PARCEL.refreshRate_;
-  // Calculate impingement limits (calcImpingementLimits)
-  inFile >> PROPS.calcImpingementLimits_;
-  // Splashing flags
-  std::getline(inFile,line);
-  std::getline(inFile,line);
-  inFile >> PARCEL.SplashFlag_;
-  inFile >> PARCEL.TrackSplashFlag_;
+  v = readInputLine(inFile,inFileName,4,NULL,0,NULL);
+  PARCEL.Xmin_ = v[0];
+  PARCEL.Xmax_ = v[1];
+  PARCEL.Ymin_ = v[2];
+  PARCEL.Ymax_ = v[3];
+  // Simulation properties: maxiter, driver refresh rate (RefreshRate),
+  // calculate impingement limits (calcImpLimits); optionally, keep every
+  // n-th particle in the recorded trajectories (TrajDecimation), threads
+  // for parallel advection (Threads; 0 = all available) and advection mode
+  // (AdvectMode; 0 = lock-step over all particles, 1 = particle-major)
+  const char* simOptional[3] = {"TrajDecimation","Threads","AdvectMode"};
+  const double simDefaults[3] = {1, 0, 0};
+  v = readInputLine(inFile,inFileName,3,simOptional,3,simDefaults);
+  PARCEL.maxiter_               = (int)v[0];
+  PARCEL.refreshRate_           = (int)v[1];
+  PROPS.calcImpingementLimits_  = (int)v[2];
+  PARCEL.trajDecimation_        = (int)v[3];
+  PARCEL.threads_               = (int)v[4];
+  PARCEL.advectMode_            = (int)v[5];
+  // Splashing flags (Splashing,TrackSplash); optionally, random seed for
+  // splash child droplets (Seed), parcel coalescing (Coalesce; 1 = merge
+  // similar parcels in a cell every step) and cap on the number of
+  // advected splash child parcels (MaxParcels; 0 = none)
+  const char* splashOptional[3] = {"Seed","Coalesce","MaxParcels"};
+  const double splashDefaults[3] = {1, 0, 0};
+  v = readInputLine(inFile,inFileName,2,splashOptional,3,splashDefaults);
+  PARCEL.SplashFlag_      = (int)v[0];
+  PARCEL.TrackSplashFlag_ = (int)v[1];
+  PARCEL.seed_            = (int)v[2];
+  PARCEL.CoalesceFlag_    = (int)v[3];
+  PARCEL.maxParcels_      = (int)v[4];
+  // Parcels are not read from file; zero means one parcel per particle
+  PARCEL.parcels_ = 0;
   // Compute derived parameters
   PROPS.rhoinf_ = PROPS.pinf_/PROPS.R_/PROPS.Tinf_;
   PROPS.Ubar_ = sqrt(1.4*PROPS.pinf_/PROPS.rhoinf_);
@@ -65,18 +141,15 @@ void readInputParams(FluidScalars& PROPS, ParcelScalars& PARCEL, const char *inF
   // THERMO PARAMETERS
   // **********************************
   
-  // Read through headers
-  for (int i=0; i<5; i++)
-    std::getline(inFile,line);
-  // First line (NPts,Uinf,LWC,Td)
-  double tmp;
-  inFile >> PROPS.NPts_;
-  inFile >> PROPS.Uinf_;
-  inFile >> PROPS.LWC_;
-  inFile >> PROPS.Td_;
-  inFile >> PROPS.chord_;
-  inFile >> PROPS.mach_;
-  inFile >> PROPS.DT_;
+  // First line (NPts,Uinf,LWC,Td,chord,mach,DT)
+  v = readInputLine(inFile,inFileName,7,NULL,0,NULL);
+  PROPS.NPts_  = (int)v[0];
+  PROPS.Uinf_  = v[1];
+  PROPS.LWC_   = v[2];
+  PROPS.Td_    = v[3];
+  PROPS.chord_ = v[4];
+  PROPS.mach_  = v[5];
+  PROPS.DT_    = v[6];
   // Close file stream
   inFile.close();
 
@@ -0,0 +1,145 @@
+#include "TrajectoryWriter.h"
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+TrajectoryWriter::TrajectoryWriter(const std::string& filename, int decimation, int bufferSize, int maxBuffers) {
+  // Constructor: open output file, write header and start writer thread
+
+  filename_ = filename;
+  file_ = fopen(filename.c_str(),"wb");
+  if (file_ == NULL) {
+    throw std::runtime_error("TrajectoryWriter: cannot open " + filename_);
+  }
+  int32_t header[4] = {0, 1, (int32_t)sizeof(TrajectoryRecord), 0};
+  memcpy(&header[0],"TRAJ",4);
+  if (fwrite(header, sizeof(int32_t), 4, file_) != 4) {
+    fclose(file_);
+    file_ = NULL;
+    throw std::runtime_error("TrajectoryWriter: cannot write header to " + filename_);
+  }
+  decimation_ = (decimation > 0) ? decimation : 1;
+  bufferSize_ = bufferSize;
+  maxBuffers_ = maxBuffers;
+  buffer_.reserve(bufferSize_);
+  done_ = false;
+  failed_ = false;
+  thread_ = std::thread(&TrajectoryWriter::writeLoop, this);
+
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+  // Destructor: write out anything still buffered (errors can only be
+  // reported here, not thrown)
+
+  try {
+    this->close();
+  }
+  catch (const std::exception& e) {
+    fprintf(stderr,"%s\n",e.what());
+  }
+}
+
+void TrajectoryWriter::record(int iter, State& state) {
+  // Function to record the state of every decimation_-th particle
+
+  TrajectoryRecord rec;
+  rec.iter = iter;
+  for (int i=0; i<state.size_; i+=decimation_) {
+    rec.id = i;
+    rec.x = state.x_(i);
+    rec.y = state.y_(i);
+    rec.u = state.u_(i);
+    rec.v = state.v_(i);
+    rec.r = state.r_(i);
+    buffer_.push_back(rec);
+    if ((int)buffer_.size() == bufferSize_) {
+      this->submit();
+    }
+  }
+
+}
+
+void TrajectoryWriter::submit() {
+  // Function to hand the current buffer to the writer thread; blocks while
+  // maxBuffers_ buffers are already waiting, which bounds the memory used.
+  // Throws once a write has failed, rather than recording into a lost file
+
+  unique_lock<mutex> lock(mutex_);
+  notFull_.wait(lock, [this] { return (int)queue_.size() < maxBuffers_; });
+  if (failed_) {
+    throw std::runtime_error("TrajectoryWriter: error writing " + filename_);
+  }
+  queue_.push_back(std::move(buffer_));
+  if (!free_.empty()) {
+    buffer_ = std::move(free_.back());
+    free_.pop_back();
+  }
+  else {
+    buffer_ = vector<TrajectoryRecord>();
+    buffer_.reserve(bufferSize_);
+  }
+  notEmpty_.notify_one();
+
+}
+
+void TrajectoryWriter::writeLoop() {
+  // Writer thread: write queued buffers to file until closed. After a
+  // failed write the remaining buffers are only drained, so the caller
+  // never blocks on a full queue
+
+  unique_lock<mutex> lock(mutex_);
+  while (true) {
+    notEmpty_.wait(lock, [this] { return (!queue_.empty()) || done_; });
+    if (queue_.empty()) {
+      break;
+    }
+    vector<TrajectoryRecord> buffer = std::move(queue_.front());
+    queue_.pop_front();
+    notFull_.notify_one();
+    bool write = !failed_;
+    lock.unlock();
+    bool ok = true;
+    if (write) {
+      ok = (fwrite(buffer.data(), sizeof(TrajectoryRecord), buffer.size(), file_) == buffer.size());
+    }
+    buffer.clear();
+    lock.lock();
+    if (!ok) {
+      failed_ = true;
+    }
+    free_.push_back(std::move(buffer));
+  }
+
+}
+
+void TrajectoryWriter::close() {
+  // Function to flush remaining records, stop the writer thread and close
+  // the file; throws if any record could not be written
+
+  if (file_ == NULL) {
+    return;
+  }
+  {
+    unique_lock<mutex> lock(mutex_);
+    if ((!buffer_.empty()) && (!failed_)) {
+      notFull_.wait(lock, [this] { return (int)queue_.size() < maxBuffers_; });
+      queue_.push_back(std::move(buffer_));
+      notEmpty_.notify_one();
+    }
+    buffer_.clear();
+    done_ = true;
+  }
+  notEmpty_.notify_one();
+  thread_.join();
+  bool failed = failed_;
+  if (fclose(file_) != 0) {
+    failed = true;
+  }
+  file_ = NULL;
+  if (failed) {
+    throw std::runtime_error("TrajectoryWriter: error writing " + filename_);
+  }
+
+}
@@ -0,0 +1,57 @@
+#ifndef __TRAJECTORYWRITER_H__
+#define __TRAJECTORYWRITER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <Cloud/State.h>
+
+// File layout: a 16 byte header (magic "TRAJ", version, record size,
+// reserved; int32) followed by fixed-size records in native byte order.
+// See TrajectoryReader.py. A file which cannot be opened or written
+// raises std::runtime_error (from the constructor, record or close)
+struct TrajectoryRecord {
+  int32_t iter;
+  int32_t id;
+  double x;
+  double y;
+  double u;
+  double v;
+  double r;
+};
+
+class TrajectoryWriter {
+  public:
+    TrajectoryWriter(const std::string& filename, int decimation, int bufferSize = 65536, int maxBuffers = 4);
+    ~TrajectoryWriter();
+    void record(int iter, State& state);
+    void close();
+
+  private:
+    std::string filename_;
+    FILE* file_;
+    int decimation_;
+    int bufferSize_;
+    int maxBuffers_;
+    // Buffer being filled by the caller, full buffers waiting for the
+    // writer thread (at most maxBuffers_), and emptied buffers for reuse
+    std::vector<TrajectoryRecord> buffer_;
+    std::deque<std::vector<TrajectoryRecord> > queue_;
+    std::vector<std::vector<TrajectoryRecord> > free_;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    bool done_;
+    bool failed_;  // a write failed; later buffers are discarded
+    std::thread thread_;
+    void submit();
+    void writeLoop();
+
+};
+
+#endif
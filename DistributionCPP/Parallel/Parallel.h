@@ -0,0 +1,36 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+// Thin wrappers around the OpenMP runtime so that the rest of the code
+// builds (serially) when OpenMP is not available
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+inline int getMaxThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+inline int getThreadNum() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+inline int resolveNumThreads(int numThreads) {
+  // Requested thread count; zero (or negative) means use all available threads
+  
+  if (numThreads <= 0) {
+    return getMaxThreads();
+  }
+  return numThreads;
+}
+
+#endif
@@ -3,314 +3,435 @@
 #include <stdio.h>
 #include <cmath>
 #include <algorithm>
+#include <limits>
+#include <assert.h>
+#include <Parallel/Parallel.h>
+#include <Grid/GridCache.h>
 
 using namespace std;
 
 Bucket::Bucket() {
   // Default constructor
-  
-  buckets_ = new Bucket*[4];
-  for (int i=0; i<4; i++) {
-    buckets_[i] = NULL;
-  }
+
   // Set default bucket size
   BucketSize_ = 20;
-  // Set level to be zero (default)
-  level_ = 0;
+  NumPts_ = 0;
 }
 
 Bucket::Bucket(const std::string workDir) {
   // Constructor + set output working directory
-  
+
   workDir_ = workDir;
-  buckets_ = new Bucket*[4];
-  for (int i=0; i<4; i++) {
-    buckets_[i] = NULL;
-  }
   // Set default bucket size
   BucketSize_ = 20;
-  // Set level to be zero (default)
-  level_ = 0;
+  NumPts_ = 0;
 }
 
-Bucket::Bucket(double* SW, double* SE, double* NW, double* NE) {
-  SW_[0] = SW[0]; SW_[1] = SW[1];
-  SE_[0] = SE[0]; SE_[1] = SE[1];
-  NW_[0] = NW[0]; NW_[1] = NW[1];
-  NE_[0] = NE[0]; NE_[1] = NE[1];
-  buckets_ = new Bucket*[4];
-  for (int i=0; i<4; i++) {
-    buckets_[i] = NULL;
-  }
-  // Set default bucket size
-  BucketSize_ = 20;
-  // Set level to be zero (default)
-  level_ = 0;
-}
+Bucket::~Bucket() {
 
-Bucket::Bucket(double* SW, double* SE, double* NW, double* NE, int level) {
-  SW_[0] = SW[0]; SW_[1] = SW[1];
-  SE_[0] = SE[0]; SE_[1] = SE[1];
-  NW_[0] = NW[0]; NW_[1] = NW[1];
-  NE_[0] = NE[0]; NE_[1] = NE[1];
-  buckets_ = new Bucket*[4];
-  for (int i=0; i<4; i++) {
-    buckets_[i] = NULL;
-  }
-  // Set default bucket size
-  BucketSize_ = 20;
-  // Set level
-  level_ = level;
 }
 
-void Bucket::setBounds(double* SW, double* SE, double* NW, double* NE) {
-  // Function to set bounds of bucket (assuming it has not been done in constructor)
+int Bucket::getNPts() {
+  // Return NumPts_
+
+  return NumPts_;
+}
 
-  SW_[0] = SW[0]; SW_[1] = SW[1];
-  SE_[0] = SE[0]; SE_[1] = SE[1];
-  NW_[0] = NW[0]; NW_[1] = NW[1];
-  NE_[0] = NE[0]; NE_[1] = NE[1];
+int Bucket::getNumNodes() {
+  // Return number of nodes in the tree
 
+  return nodes_.size();
 }
 
-Bucket::~Bucket() {
-  for (int i=0; i<4; i++) {
-    delete buckets_[i];
-  }
-  delete buckets_;
+void Bucket::setBucketSize(int BS) {
+  // Set bucket size
+
+  BucketSize_ = BS;
 }
 
-void Bucket::addNode(int ind, double* sw, double* se, double* nw, double* ne) {
-  // Add a node to the bucket
-  // 'ind' specifies which bucket is being added
-  // [0,1,2,3] = [NE,NW,SW,SE]
-  
-  buckets_[ind] = new Bucket(sw,se,nw,ne,level_+1);
+static inline uint64_t spreadBits(uint32_t v) {
+  // Spread the bits of v to the even bit positions of a 64 bit word
+
+  uint64_t x = v;
+  x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+  x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+  x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+  x = (x | (x << 2))  & 0x3333333333333333ULL;
+  x = (x | (x << 1))  & 0x5555555555555555ULL;
+
+  return x;
 }
 
-void Bucket::setPoints(double* dataX, double* dataY, vector<int>& indData, int NumPts) {
-  // Function to pass in a data set and determine the subset contained in bucket
-  
-  int count = 0;
-  PX_.reserve(NumPts);
-  PY_.reserve(NumPts);
-  indData_.reserve(NumPts);
-  bool flag1, flag2, flag3, flag4, flag;
-  for (int i=0; i<NumPts; i++) {
-    flag1 = (dataX[i] >= SW_[0]);
-    flag2 = (dataX[i] <= SE_[0]);
-    flag3 = (dataY[i] >= SW_[1]);
-    flag4 = (dataY[i] <= NW_[1]);
-
-    flag = flag1 && flag2 && flag3 && flag4;
-    if (flag==true) {
-	PX_[count] = dataX[i];
-	PY_[count] = dataY[i];
-        indData_.push_back(indData[i]);
-	count++;
+template <class T>
+static void parallelSort(vector<T>& v) {
+  // Sort contiguous chunks in parallel, then merge pairs of sorted runs
+  // (also in parallel) until one run is left
+
+  int n = v.size();
+  int numChunks = (n < 16384) ? 1 : getMaxThreads();
+  vector<int> bounds(numChunks+1);
+  for (int c=0; c<=numChunks; c++) {
+    bounds[c] = (long)n*c/numChunks;
+  }
+#pragma omp parallel for schedule(static)
+  for (int c=0; c<numChunks; c++) {
+    sort(v.begin()+bounds[c],v.begin()+bounds[c+1]);
+  }
+  for (int width=1; width<numChunks; width*=2) {
+#pragma omp parallel for schedule(static)
+    for (int c=0; c<numChunks; c+=2*width) {
+      if (c+width < numChunks) {
+        inplace_merge(v.begin()+bounds[c],v.begin()+bounds[c+width],v.begin()+bounds[min(c+2*width,numChunks)]);
+      }
     }
   }
-  NumPts_ = count;
 
 }
 
-void Bucket::getPoints(vector<double>* PX, vector<double>* PY, vector<int>* indXY) {
-  // Function to return points in the data set and their indices
-  
-  PX->reserve(NumPts_); PY->reserve(NumPts_); indXY->reserve(NumPts_);
+void Bucket::sortPoints(double* dataX, double* dataY) {
+  // Function to compute the Morton code of each point (coordinates
+  // quantized to MAXDEPTH bits on the bounding box of the data) and to
+  // store the points sorted along the curve
+
+  double xmin = dataX[0], xmax = dataX[0];
+  double ymin = dataY[0], ymax = dataY[0];
+  for (int i=1; i<NumPts_; i++) {
+    xmin = min(xmin,dataX[i]); xmax = max(xmax,dataX[i]);
+    ymin = min(ymin,dataY[i]); ymax = max(ymax,dataY[i]);
+  }
+  const double cells = (double)((1u << MAXDEPTH) - 1);
+  xminCode_ = xmin;
+  yminCode_ = ymin;
+  sxCode_ = (xmax > xmin) ? cells/(xmax-xmin) : 0.0;
+  syCode_ = (ymax > ymin) ? cells/(ymax-ymin) : 0.0;
+  vector<pair<uint64_t,int> > keys(NumPts_);
+#pragma omp parallel for schedule(static)
   for (int i=0; i<NumPts_; i++) {
-    PX->push_back(PX_[i]);
-    PY->push_back(PY_[i]);
-    indXY->push_back(indData_[i]);
+    keys[i] = make_pair(this->calcCode(dataX[i],dataY[i]), i);
+  }
+  parallelSort(keys);
+  code_.resize(NumPts_);
+  PX_.resize(NumPts_);
+  PY_.resize(NumPts_);
+  indData_.resize(NumPts_);
+#pragma omp parallel for schedule(static)
+  for (int i=0; i<NumPts_; i++) {
+    int ind = keys[i].second;
+    code_[i] = keys[i].first;
+    PX_[i] = dataX[ind];
+    PY_[i] = dataY[ind];
+    indData_[i] = ind;
   }
-}
-
-int Bucket::getNPts() {
-  // Return NumPts_
 
-  return NumPts_;
 }
 
-int Bucket::getLevel() {
-  // Return level
+uint64_t Bucket::calcCode(double x, double y) {
+  // Function to return the Morton code of a point (points outside the
+  // bounding box of the data are clamped onto it)
+
+  const double cells = (double)((1u << MAXDEPTH) - 1);
+  uint32_t qx = (uint32_t)max(min((x-xminCode_)*sxCode_,cells),0.0);
+  uint32_t qy = (uint32_t)max(min((y-yminCode_)*syCode_,cells),0.0);
 
-  return level_;
+  return spreadBits(qx) | (spreadBits(qy) << 1);
 }
 
-void Bucket::setBucketSize(int BS) {
-  // Set bucket size
+void Bucket::splitNode(int node, int* first) {
+  // Function to find where the points of a node split between its four
+  // children: child q owns the sorted points [first[q],first[q+1])
+
+  const Node& N = nodes_[node];
+  int shift = 2*(MAXDEPTH-1-N.level);
+  uint64_t prefix = (code_[N.first] >> (shift+2)) << (shift+2);
+  vector<uint64_t>::iterator begin = code_.begin()+N.first;
+  vector<uint64_t>::iterator end = begin+N.count;
+  first[0] = N.first;
+  for (int q=1; q<4; q++) {
+    uint64_t key = prefix | ((uint64_t)q << shift);
+    first[q] = lower_bound(begin,end,key) - code_.begin();
+  }
+  first[4] = N.first + N.count;
 
-  BucketSize_ = BS;
 }
 
-void Bucket::divideBucket() {
-  // Function to divide a bucket if the number of points inside of it exceeds threshold
-  
-  if (NumPts_ > BucketSize_) {
-    // Calculate centroids
-    double S[2]; S[0] = 0.5*(SW_[0]+SE_[0]); S[1] = 0.5*(SW_[1]+SE_[1]);
-    double N[2]; N[0] = 0.5*(NW_[0]+NE_[0]); N[1] = 0.5*(NW_[1]+NE_[1]);
-    double E[2]; E[0] = 0.5*(SE_[0]+NE_[0]); E[1] = 0.5*(SE_[1]+NE_[1]);
-    double W[2]; W[0] = 0.5*(SW_[0]+NW_[0]); W[1] = 0.5*(SW_[1]+NW_[1]);
-    double C[2]; C[0] = 0.5*(SW_[0]+NE_[0]); C[1] = 0.5*(SW_[1]+NE_[1]);
-
-    // Add nodes as [0,1,2,3] = [NE,NW,SW,SE] buckets
-    this->addNode(0,&C[0],&E[0],&N[0],&NE_[0]);
-    this->addNode(1,&W[0],&C[0],&NW_[0],&N[0]);
-    this->addNode(2,&SW_[0],&S[0],&W[0],&C[0]);
-    this->addNode(3,&S[0],&SE_[0],&C[0],&E[0]);
-
-    // Calculate data inside each of the new child buckets
-    this->buckets_[0]->setPoints(&PX_[0],&PY_[0],indData_,NumPts_);
-    this->buckets_[1]->setPoints(&PX_[0],&PY_[0],indData_,NumPts_);
-    this->buckets_[2]->setPoints(&PX_[0],&PY_[0],indData_,NumPts_);
-    this->buckets_[3]->setPoints(&PX_[0],&PY_[0],indData_,NumPts_);
+void Bucket::calcNodeBounds(int node) {
+  // Function to compute the bounding box of the points in a leaf
+  // (empty leaves get an inverted box, which is never searched)
+
+  Node& N = nodes_[node];
+  N.xmin = N.ymin = numeric_limits<double>::infinity();
+  N.xmax = N.ymax = -numeric_limits<double>::infinity();
+  for (int i=N.first; i<N.first+N.count; i++) {
+    N.xmin = min(N.xmin,PX_[i]); N.xmax = max(N.xmax,PX_[i]);
+    N.ymin = min(N.ymin,PY_[i]); N.ymax = max(N.ymax,PY_[i]);
   }
+
 }
 
 void Bucket::calcQuadTree(double* dataX, double* dataY, int NumPts) {
   // Function to handle the entire construction of the quadtree
-  
-  // Initialize indices of mother bucket
-  vector<int> indData;
-  indData.reserve(NumPts);
-  for (int i=0; i<NumPts; i++) {
-    indData.push_back(i);
-  }
-  // Set points from dataset given
-  this->setPoints(dataX,dataY,indData,NumPts);
-  // Recursive division of the quadtree until finest levels 
-  // of resolution agree with bucket size
-  vector<Bucket*> current;
-  current.push_back(this);
-  vector<Bucket*> next;
-  int sizeCurrent = 1;
-  int numNext = 0;
-  bool flag = false;
-  FILE* fout;
-  if (!workDir_.empty()) {
-    const std::string outFile = workDir_ + "/QuadTreeXY.dat";
-    fout = fopen(outFile.c_str(),"w");
+
+  NumPts_ = NumPts;
+  nodes_.clear();
+  if (NumPts_ == 0) {
+    return;
   }
-  Bucket* child;
-  // Print initial bucket to file
-  if (!workDir_.empty()) {
-    fprintf(fout,"%f\t%f\n", this->SW_[0], this->SW_[1]);
-    fprintf(fout,"%f\t%f\n", this->SE_[0], this->SE_[1]);
-    fprintf(fout,"%f\t%f\n", this->NE_[0], this->NE_[1]);
-    fprintf(fout,"%f\t%f\n", this->NW_[0], this->NW_[1]);
+  this->sortPoints(dataX,dataY);
+  // Root node owns all points
+  Node root;
+  root.first = 0; root.count = NumPts_; root.child = -1; root.level = 0;
+  nodes_.push_back(root);
+  // Divide the tree level by level until all leaves hold at most
+  // BucketSize_ points (or the resolution of the codes is reached). The
+  // split points of a level are found in parallel; children are then
+  // appended in order, so the four children of a node are contiguous
+  vector<int> current;
+  vector<int> next;
+  if (NumPts_ > BucketSize_) {
+    current.push_back(0);
   }
-  
-  while(flag==false) {
-    // Divide current
-    for (int i=0; i<sizeCurrent; i++) {
-      current[i]->divideBucket();
-      // Check 4 children
-      for (int j=0; j<4; j++) {
-	child = current[i]->buckets_[j];
-	if (child->getNPts() > BucketSize_) {
-	  next.push_back(child);
-	  numNext++;
-	}
-	// Print to file
-        if (!workDir_.empty()) {
-	  fprintf(fout,"%f\t%f\n", child->SW_[0], child->SW_[1]);
-	  fprintf(fout,"%f\t%f\n", child->SE_[0], child->SE_[1]);
-	  fprintf(fout,"%f\t%f\n", child->NE_[0], child->NE_[1]);
-	  fprintf(fout,"%f\t%f\n", child->NW_[0], child->NW_[1]);
+  while (!current.empty()) {
+    int numCurrent = current.size();
+    vector<int> first(5*numCurrent);
+#pragma omp parallel for schedule(dynamic,64)
+    for (int i=0; i<numCurrent; i++) {
+      this->splitNode(current[i],&first[5*i]);
+    }
+    next.clear();
+    for (int i=0; i<numCurrent; i++) {
+      int level = nodes_[current[i]].level + 1;
+      nodes_[current[i]].child = nodes_.size();
+      for (int q=0; q<4; q++) {
+        Node child;
+        child.first = first[5*i+q];
+        child.count = first[5*i+q+1] - first[5*i+q];
+        child.child = -1;
+        child.level = level;
+        if ((child.count > BucketSize_) && (level < MAXDEPTH)) {
+          next.push_back(nodes_.size());
         }
+        nodes_.push_back(child);
       }
     }
-    if (numNext>0) {
-      // Reset current nodes
-      current.swap(next);
-      next.clear();
-      sizeCurrent = numNext;
-      numNext = 0;
+    current.swap(next);
+  }
+  // Bounding boxes: leaves from their points, then each parent from its
+  // children (children always follow their parent in nodes_)
+  int numNodes = nodes_.size();
+#pragma omp parallel for schedule(dynamic,256)
+  for (int n=0; n<numNodes; n++) {
+    if (nodes_[n].child < 0) {
+      this->calcNodeBounds(n);
     }
-    else {
-      // Exit; no more divisions needed
-      //printf("Quadtree successfully created. Bucket coordinates written to QuadTreeXY.dat. \n");
-      flag = true;
-      break;
+  }
+  for (int n=numNodes-1; n>=0; n--) {
+    Node& N = nodes_[n];
+    if (N.child >= 0) {
+      N.xmin = N.ymin = numeric_limits<double>::infinity();
+      N.xmax = N.ymax = -numeric_limits<double>::infinity();
+      for (int q=0; q<4; q++) {
+        const Node& C = nodes_[N.child+q];
+        N.xmin = min(N.xmin,C.xmin); N.xmax = max(N.xmax,C.xmax);
+        N.ymin = min(N.ymin,C.ymin); N.ymax = max(N.ymax,C.ymax);
+      }
+    }
+  }
+
+}
+
+void Bucket::writeQuadTree() {
+  // Function to write the bounding box corners of every non-empty node to
+  // QuadTreeXY.dat in the output directory (for BucketPlotter.py)
+
+  const std::string outFile = workDir_.empty() ? "QuadTreeXY.dat" : workDir_ + "/QuadTreeXY.dat";
+  FILE* fout = fopen(outFile.c_str(),"w");
+  assert(fout != NULL);
+  for (size_t n=0; n<nodes_.size(); n++) {
+    const Node& N = nodes_[n];
+    if (N.count > 0) {
+      fprintf(fout,"%f\t%f\n", N.xmin, N.ymin);
+      fprintf(fout,"%f\t%f\n", N.xmax, N.ymin);
+      fprintf(fout,"%f\t%f\n", N.xmax, N.ymax);
+      fprintf(fout,"%f\t%f\n", N.xmin, N.ymax);
     }
-  
   }
-  if (!workDir_.empty()) {
-    fclose(fout);
+  fclose(fout);
+
+}
+
+void Bucket::writeTree(FILE* fout) {
+  // Function to write the built tree (sorted points and nodes) to a grid
+  // cache file
+
+  int32_t sizes[3] = {NumPts_, BucketSize_, (int32_t)nodes_.size()};
+  double quant[4] = {xminCode_, yminCode_, sxCode_, syCode_};
+  writeCacheArray(fout, sizes, sizeof(sizes));
+  writeCacheArray(fout, quant, sizeof(quant));
+  writeCacheArray(fout, nodes_.data(), nodes_.size()*sizeof(Node));
+  writeCacheArray(fout, code_.data(), code_.size()*sizeof(uint64_t));
+  writeCacheArray(fout, PX_.data(), PX_.size()*sizeof(double));
+  writeCacheArray(fout, PY_.data(), PY_.size()*sizeof(double));
+  writeCacheArray(fout, indData_.data(), indData_.size()*sizeof(int));
+
+}
+
+bool Bucket::readTree(const char* buf, size_t size, size_t& pos) {
+  // Function to read a tree written by writeTree; returns false (leaving
+  // the tree unusable) if the data does not match
+
+  int32_t sizes[3];
+  double quant[4];
+  if (!readCacheArray(buf,size,pos,sizes,sizeof(sizes)) || !readCacheArray(buf,size,pos,quant,sizeof(quant))) {
+    return false;
+  }
+  if ((sizes[0] < 0) || (sizes[2] < 0)) {
+    return false;
   }
-  
+  NumPts_ = sizes[0];
+  BucketSize_ = sizes[1];
+  xminCode_ = quant[0]; yminCode_ = quant[1];
+  sxCode_ = quant[2];   syCode_ = quant[3];
+  nodes_.resize(sizes[2]);
+  code_.resize(NumPts_);
+  PX_.resize(NumPts_);
+  PY_.resize(NumPts_);
+  indData_.resize(NumPts_);
+
+  return (readCacheArray(buf,size,pos,nodes_.data(),nodes_.size()*sizeof(Node)) &&
+          readCacheArray(buf,size,pos,code_.data(),code_.size()*sizeof(uint64_t)) &&
+          readCacheArray(buf,size,pos,PX_.data(),PX_.size()*sizeof(double)) &&
+          readCacheArray(buf,size,pos,PY_.data(),PY_.size()*sizeof(double)) &&
+          readCacheArray(buf,size,pos,indData_.data(),indData_.size()*sizeof(int)));
 }
 
-bool Bucket::calcInBucket(double* Xq, double* Yq) {
-  // Function to determine whether a query point is inside a bucket
-
-  bool flag1, flag2, flag3, flag4, flag;
-  flag1 = (*Xq >= this->SW_[0]);
-  flag2 = (*Xq <= this->SE_[0]);
-  flag3 = (*Yq >= this->SW_[1]);
-  flag4 = (*Yq <= this->NW_[1]);
-  flag = flag1 && flag2 && flag3 && flag4;
-  
-  return flag;
+double Bucket::calcBoxDist(const Node& node, double Xq, double Yq) {
+  // Function to return the squared distance from a query point to the
+  // bounding box of a node (zero if the point is inside)
+
+  double dx = std::max(std::max(node.xmin-Xq, Xq-node.xmax), 0.0);
+  double dy = std::max(std::max(node.ymin-Yq, Yq-node.ymax), 0.0);
+
+  return dx*dx + dy*dy;
 }
 
 void Bucket::knnSearch(double* Xq, double* Yq, double* Xnn, double* Ynn, int* indnn) {
-  // Function that takes a query point and finds the nearest 
+  // Function that takes a query point and finds the nearest
   // neighbor in the data set of the quadtree
 
-  bool flagFinal = false;
-  bool flagChild = false;
-  bool flagHasPts;
-  Bucket* current = this;
-  int iter;
-  // Iteratively search down the tree
-  while(flagFinal==false) {
-    // Determine if current bucket has child iter
-    iter = -1;
-    while((flagChild==false) && (iter<3)) {
-      iter++;
-      if (current->buckets_[iter] != NULL) {
-        // If child iter exists, search it and make sure there are pts inside it
-        flagChild = current->buckets_[iter]->calcInBucket(Xq,Yq);
-        flagHasPts = current->buckets_[iter]->NumPts_ > 0;
-      }
-    }
-    // If we have found a valid child containing (Xq,Yq), reset current
-    if ((flagChild==true) && (flagHasPts==true)) {
-      current = current->buckets_[iter];
-      flagChild = false;
-    }
-    // Otherwise, we are done
-    else {
-      flagFinal = true;
-    }
-
+  if (NumPts_ == 0) {
+    return;
   }
+  double distMin = std::numeric_limits<double>::infinity();
+  int indMin = -1;
+  this->searchTree(*Xq,*Yq,distMin,indMin);
+  *Xnn = PX_[indMin];
+  *Ynn = PY_[indMin];
+  *indnn = indData_[indMin];
+
+}
 
-  // Calculate nearest neighbor inside bucket
-  int BS = BucketSize_;
-  double* dist = new double[BS];
-  vector<double> x;
-  vector<double> y;
-  vector<int> ind;
-  current->getPoints(&x,&y,&ind);
-  for (int i=0; i<BS; i++) {
-    dist[i] = pow(x[i]-*Xq,2) + pow(y[i]-*Yq,2);
+void Bucket::knnSearch(int n, const double* Xq, const double* Yq, double* Xnn, double* Ynn, int* indnn) {
+  // Function that finds the nearest neighbors of n query points (Xnn and
+  // Ynn may be NULL if only the indices are wanted)
+
+  // Queries are sorted along the same Morton curve as the data, so that
+  // consecutive queries are close to each other. Runs of BATCHRUN sorted
+  // queries are searched in parallel, each search starting from the
+  // neighbor of the previous query as the bound, which prunes all but a
+  // few nodes near the answer
+  if ((NumPts_ == 0) || (n <= 0)) {
+    return;
+  }
+  vector<pair<uint64_t,int> > order(n);
+#pragma omp parallel for schedule(static)
+  for (int i=0; i<n; i++) {
+    order[i] = make_pair(this->calcCode(Xq[i],Yq[i]), i);
   }
-  int indMin = 0;
-  double distMin = dist[0];
-  for (int i=1; i<current->NumPts_; i++) {
-    if (dist[i] < distMin) {
-      distMin = dist[i];
-      indMin = i;
+  parallelSort(order);
+  int numRuns = (n + BATCHRUN - 1)/BATCHRUN;
+#pragma omp parallel for schedule(dynamic)
+  for (int run=0; run<numRuns; run++) {
+    int indPrev = -1;
+    for (int k=run*BATCHRUN; k<min(n,(run+1)*BATCHRUN); k++) {
+      int i = order[k].second;
+      double distMin = std::numeric_limits<double>::infinity();
+      int indMin = -1;
+      if (indPrev >= 0) {
+        double dx = PX_[indPrev]-Xq[i];
+        double dy = PY_[indPrev]-Yq[i];
+        distMin = dx*dx + dy*dy;
+        indMin = indPrev;
+      }
+      this->searchTree(Xq[i],Yq[i],distMin,indMin);
+      if (Xnn != NULL) {
+        Xnn[i] = PX_[indMin];
+      }
+      if (Ynn != NULL) {
+        Ynn[i] = PY_[indMin];
+      }
+      indnn[i] = indData_[indMin];
+      indPrev = indMin;
     }
   }
-  *Xnn = x[indMin];
-  *Ynn = y[indMin];
-  *indnn = ind[indMin];
 
-  delete[] dist;
+}
+
+void Bucket::searchTree(double xq, double yq, double& distMin, int& indMin) {
+  // Function to search the tree for a point closer to (xq,yq) than
+  // distMin (squared); on return distMin/indMin hold the nearest point
+
+  // Depth-first search, visiting the children of each node nearest
+  // first and skipping any node which is farther from the query than
+  // the best point found so far. Pending nodes are kept on a fixed-size
+  // stack (at most 3 per level, plus the children of the deepest), so no
+  // memory is allocated per query
+  const int MAXSTACK = 3*MAXDEPTH + 4;
+  int stack[MAXSTACK];
+  int numStack = 0;
+  stack[numStack++] = 0;
+  while (numStack > 0) {
+    const Node& current = nodes_[stack[--numStack]];
+    if (this->calcBoxDist(current,xq,yq) >= distMin) {
+      continue;
+    }
+    if (current.child < 0) {
+      // Leaf: check its points
+      for (int i=current.first; i<current.first+current.count; i++) {
+        double dx = PX_[i]-xq;
+        double dy = PY_[i]-yq;
+        double dist = dx*dx + dy*dy;
+        if (dist < distMin) {
+          distMin = dist;
+          indMin = i;
+        }
+      }
+    }
+    else {
+      // Push non-empty children which may hold a closer point, farthest
+      // first so that the nearest is searched next
+      int child[4];
+      double dist[4];
+      int numChild = 0;
+      for (int j=0; j<4; j++) {
+        int c = current.child + j;
+        double d = this->calcBoxDist(nodes_[c],xq,yq);
+        if ((nodes_[c].count > 0) && (d < distMin)) {
+          int k = numChild++;
+          while ((k > 0) && (dist[k-1] < d)) {
+            child[k] = child[k-1];
+            dist[k] = dist[k-1];
+            k--;
+          }
+          child[k] = c;
+          dist[k] = d;
+        }
+      }
+      assert(numStack + numChild <= MAXSTACK);
+      for (int j=0; j<numChild; j++) {
+        stack[numStack++] = child[j];
+      }
+    }
+  }
 
 }
 
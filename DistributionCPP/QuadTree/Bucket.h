@@ -3,37 +3,60 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
+#include <stdio.h>
+
+// Bucket quadtree for nearest neighbor searches. Points are sorted along a
+// Morton (Z-order) curve, so that every node of the tree owns a contiguous
+// range of the sorted points; nodes are stored in one array, each with the
+// index of its first child (the 4 children are contiguous) and the tight
+// bounding box of its points
 
 class Bucket {
  public:
   Bucket();
   Bucket(const std::string workDir);
-  Bucket(double* SW, double* SE, double* NW, double* NE);
-  Bucket(double* SW, double* SE, double* NW, double* NE, int level);
   ~Bucket();
-  double SW_[2], SE_[2], NW_[2], NE_[2];
-  Bucket** buckets_;
-  void setBounds(double* SW, double* SE, double* NW, double* NE);
-  void addNode(int ind, double* sw, double* se, double* nw, double* ne);
-  void setPoints(double* dataX, double* dataY, std::vector<int>& indData, int NumPts);
-  void getPoints(std::vector<double>* PX, std::vector<double>* PY, std::vector<int>* indXY);
   int getNPts();
-  int getLevel();
+  int getNumNodes();
   void setBucketSize(int BS);
-  void divideBucket();
   void calcQuadTree(double* dataX, double* dataY, int NumPts);
   void knnSearch(double* Xq, double* Yq, double* Xnn, double* Ynn, int* indnn);
+  void knnSearch(int n, const double* Xq, const double* Yq, double* Xnn, double* Ynn, int* indnn);
   void setOutDir(const std::string workDir);
+  void writeQuadTree();
+  void writeTree(FILE* fout);
+  bool readTree(const char* buf, size_t size, size_t& pos);
 
  private:
+  struct Node {
+    double xmin, ymin, xmax, ymax;
+    int first;   // first point (in sorted order)
+    int count;   // number of points
+    int child;   // index of first child, or -1 for a leaf
+    int level;
+  };
+  // Bits per coordinate in the Morton code, which is also the maximum
+  // depth of the tree and sizes the search stack
+  static const int MAXDEPTH = 31;
+  // Queries per contiguous run of a batched search
+  static const int BATCHRUN = 256;
   std::string workDir_;
+  std::vector<Node> nodes_;
+  std::vector<uint64_t> code_;
   std::vector<double> PX_;
   std::vector<double> PY_;
   std::vector<int> indData_;
   int NumPts_;
   int BucketSize_;
-  int level_;
-  bool calcInBucket(double* Xq, double* Yq);
+  // Quantization of coordinates for the Morton codes
+  double xminCode_, yminCode_, sxCode_, syCode_;
+  void sortPoints(double* dataX, double* dataY);
+  uint64_t calcCode(double x, double y);
+  void splitNode(int node, int* first);
+  void calcNodeBounds(int node);
+  double calcBoxDist(const Node& node, double Xq, double Yq);
+  void searchTree(double xq, double yq, double& distMin, int& indMin);
 };
 
 
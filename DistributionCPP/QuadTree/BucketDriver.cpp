@@ -10,12 +10,8 @@ using namespace std;
 // Driver program to test Bucket class
 
 int main(int argc, const char *argv[]) {
-  // Initialize first bucket
-  double SW[2] = {0.,0.};
-  double SE[2] = {1.,0.};
-  double NW[2] = {0.,1.};
-  double NE[2] = {1.,1.};
-  Bucket* QT = new Bucket(&SW[0],&SE[0],&NW[0],&NE[0]);
+  // Initialize bucket (the tree is built on the bounding box of the data)
+  Bucket* QT = new Bucket();
 
   // Test set/get points
   const int nrolls=1000;  // number of experiments
@@ -37,11 +33,14 @@ int main(int argc, const char *argv[]) {
 
   // Divide buckets
   QT->calcQuadTree(&sampsX[0],&sampsY[0],nrolls);
+  QT->setOutDir(".");
+  QT->writeQuadTree();
 
   // Search for a query point
   double Xq = 0.41;
   double Yq = 0.5;
-  double Xnn, Ynn, indnn;
+  double Xnn, Ynn;
+  int indnn;
   QT->knnSearch(&Xq,&Yq,&Xnn,&Ynn,&indnn);
   
   printf("Xq = %f, Yq = %f\nXnn = %f, Ynn = %f\n",Xq,Yq,Xnn,Ynn);
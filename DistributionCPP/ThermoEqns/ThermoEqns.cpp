@@ -527,7 +527,7 @@ void ThermoEqns::computePstat(PLOT3D& p3d) {
 
   double gamma = 1.4;
   // Get flow variables from PLOT3D object
-  Eigen::MatrixXf P = p3d.getP();
+  const Eigen::MatrixXf& P = p3d.getP();
   int NX = p3d.getNX();
   int NY = p3d.getNY();
   // Pull out wrap corresponding to edge of boundary layer
@@ -0,0 +1,28 @@
+import numpy as np
+
+# Reader for the binary particle trajectory files (DropletXY.bin) written by
+# Output/TrajectoryWriter: a 16 byte header (magic "TRAJ", version, record
+# size, reserved; int32) followed by fixed-size records in native byte order
+
+RECORD = np.dtype([('iter','i4'),('id','i4'),('x','f8'),('y','f8'),('u','f8'),('v','f8'),('r','f8')]);
+
+def readTrajectories(filename):
+    # Return all records as a numpy structured array with fields
+    # iter, id, x, y, u, v, r
+    f = open(filename,'rb');
+    header = np.fromfile(f, dtype='i4', count=4);
+    if (header.size < 4) or (header[0:1].tobytes() != b'TRAJ'):
+        f.close();
+        raise IOError(filename + " is not a trajectory file");
+    if header[2] != RECORD.itemsize:
+        f.close();
+        raise IOError(filename + ": unexpected record size " + str(header[2]));
+    data = np.fromfile(f, dtype=RECORD);
+    f.close();
+    return data;
+
+def particlePath(data, pid):
+    # Return (x,y) history of particle 'pid', ordered by iteration
+    rec = data[data['id'] == pid];
+    rec = rec[np.argsort(rec['iter'], kind='mergesort')];
+    return rec['x'], rec['y'];